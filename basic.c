@@ -1,137 +1,734 @@
 /*
  * Tiny BASIC Interpreter - C implementation for MSVC
- * Supports: PRINT, LET, GOTO, IF, END, DIM
+ * Supports: PRINT, LET, GOTO, IF, END, DIM, FOR/NEXT, PARALLEL FOR,
+ * GOSUB/RETURN, MAT, INPUT, DATA/READ/RESTORE
  * Variables A-Z, integer arithmetic, LOAD, SAVE, RUN, LIST, NEW, QUIT
+ * Program lines are stored tokenized and compiled to bytecode at RUN;
+ * direct statements are interpreted from text. All state lives in an
+ * interpreter context; see basic.h to embed it (build with BASIC_NO_MAIN).
  */
 
 #define _CRT_SECURE_NO_WARNINGS
+#include "basic.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <time.h>
+#include <signal.h>
+#ifdef _WIN32
+#include <io.h>
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#pragma comment(lib, "ws2_32.lib")
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netdb.h>
+#endif
 
-#define MAX_LINES      1000
-#define MAX_LINELEN    256
 #define NUM_VARS       26
+#define NUM_TEMPS      64       /* hidden variables for values hoisted out of loops */
+#define ARENA_BLOCK    65536
+#define OUT_BUF_SIZE   65536
+#define INPUT_BUF_SIZE 65536
+#define CTRL_DEPTH     1024     /* nested FOR loops and GOSUBs */
+#define ARRAY_MAP_MIN  65536    /* elements; larger arrays get their own pages */
 
-/* Program line: line number + source text */
+/* Program line: line number + tokenized statement (see tokenize()) */
 typedef struct {
     int num;
-    char text[MAX_LINELEN];
+    int len;                /* token bytes, excluding the terminating 0 */
+    unsigned char* tok;
+    int* code;              /* compiled statement, or NULL; see compile_program() */
+    int code_len;
+    int stack_max;
+    int unreachable;        /* left out of the linked code, see find_reachable() */
+    int* data;              /* DATA values, parsed along with the code */
+    int data_len;
 } Line;
 
-static Line program[MAX_LINES];
-static int num_program_lines = 0;
+/*
+ * Bump allocator for program storage: allocations are carved out of
+ * large blocks and released together by arena_reset(). Token bytes and
+ * code of a replaced or deleted line stay in the arena until the next reset.
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size, used;
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;
+} Arena;
+
+static void* arena_alloc(Arena* a, size_t n) {
+    ArenaBlock* b = a->head;
+    n = (n + 7) & ~(size_t)7;
+    if (!b || b->size - b->used < n) {
+        size_t size = n > ARENA_BLOCK / 4 ? n : ARENA_BLOCK;
+        b = (ArenaBlock*)malloc(sizeof(ArenaBlock) + size);
+        b->size = size;
+        b->used = 0;
+        if (a->head && size != ARENA_BLOCK) {
+            /* oversized request: keep filling the current block afterwards */
+            b->next = a->head->next;
+            a->head->next = b;
+        } else {
+            b->next = a->head;
+            a->head = b;
+        }
+    }
+    b->used += n;
+    return (unsigned char*)(b + 1) + b->used - n;
+}
+
+/* Give back the unused tail of the most recent allocation p */
+static void arena_trim(Arena* a, void* p, size_t old_n, size_t new_n) {
+    ArenaBlock* b = a->head;
+    old_n = (old_n + 7) & ~(size_t)7;
+    new_n = (new_n + 7) & ~(size_t)7;
+    if (b && (unsigned char*)p + old_n == (unsigned char*)(b + 1) + b->used) b->used -= old_n - new_n;
+}
+
+static void arena_reset(Arena* a) {
+    while (a->head) {
+        ArenaBlock* next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+}
+
+/* Interned string constants; the pool only grows until the program is cleared */
+typedef struct {
+    int off, len;
+} StrRef;
+
+/* Loop the optimizer hoisted invariant values out of, see find_loops() */
+typedef struct {
+    int head, first, last;      /* lines: the preheader goes before head, values come from first..last */
+    unsigned int vars, arrays;  /* bit v: written somewhere in the loop */
+    int pre, body, end;         /* code offsets: preheader, after it, after the last line */
+} Loop;
+
+/*
+ * A program: its lines, the string constants they use and the code
+ * compiled from them. Running a compiled program only reads it.
+ */
+typedef struct {
+    Line* lines;                /* sorted by line number */
+    int num_lines, lines_cap;
+    Arena line_arena;           /* token bytes and compiled statements of program lines */
+    Arena code_arena;           /* linked code, rebuilt on every compile */
+    char* str_pool;
+    int str_len, str_cap;
+    StrRef* strs;
+    int num_strs, strs_cap;
+    int* str_hash;              /* open addressing: string id + 1, 0 = empty */
+    int str_hash_size;
+    int* code;                  /* compiled program, in code_arena */
+    int code_len;
+    int* line_pc;               /* code offset of each line, in code_arena */
+    int* pc_line;               /* line index of each code offset, in code_arena */
+    int stack_max;              /* value stack words the code needs */
+    int code_valid;             /* code matches lines[] and the optimizer setting */
+    int num_threaded;           /* jumps threaded by the last link */
+    Loop* loops;                /* innermost first, in code_arena */
+    int num_loops;
+    int* line_loop;             /* loop each line heads, or -1; NULL after CLOAD */
+    int* data;                  /* DATA values of all lines in order, in code_arena */
+    int data_len;
+    int* line_data;             /* offset in data of each line's first value, in code_arena */
+} Program;
+
+/* Memory behind an array, kept across RUNs for reuse by DIM */
+typedef struct {
+    int* mem;
+    int size;                   /* elements */
+    int mapped;                 /* from map_array(), else from calloc() */
+} ArrayBlock;
+
+/* FOR or GOSUB in progress. pc is where NEXT or RETURN continues: a code
+   offset in the VM, a line index in the text interpreter. */
+typedef struct {
+    int var;                    /* FOR variable, or -1 for GOSUB */
+    int limit, step;
+    int pc;
+} CtrlFrame;
+
+/*
+ * Interpreter context: one program and everything needed to edit, compile
+ * and run it. Nothing is shared between contexts, so separate contexts may
+ * run on separate threads.
+ */
+struct Interp {
+    Program* prog;
+    int prog_shared;            /* prog belongs to another context, see interp_share() */
+
+    /* Variables A-Z (index 0 = A, 25 = Z), then the hoisted values */
+    int vars[NUM_VARS + NUM_TEMPS];
+    /* Arrays: ptr to data, size (0 = not dimensioned) */
+    int* arrays[NUM_VARS];
+    int array_sizes[NUM_VARS];
+    long long array_bytes;      /* total size of the arrays */
+    ArrayBlock array_blocks[NUM_VARS];
+    CtrlFrame ctrl[CTRL_DEPTH];
+    int ctrl_sp;
+    int data_pos;               /* next value READ takes from prog->data */
+    int run_mode;               /* 0 = idle, 1 = running */
+
+    /* Run limits, see run_check(); 0 = unlimited */
+    long long max_steps, max_ms, max_array_bytes;
+    long long fuel;                 /* steps left before the next run_check() */
+    long long steps_left;           /* budget not yet handed out as fuel */
+    unsigned long long deadline;    /* clock_ns() at which the run times out, or 0 */
+    volatile sig_atomic_t interrupt;
+    int stop_line;                  /* line number where the last run was stopped */
+    int stop_pc;                    /* code offset where it would go on, or -1 */
+
+    /* Checkpoints, see checkpoint_save() */
+    const char* checkpoint_file;    /* saved when a run stops and periodically */
+    long long checkpoint_every;     /* steps between periodic checkpoints, 0 = none */
+    long long checkpoint_at;        /* steps_left + fuel when the next one is due */
+    volatile sig_atomic_t checkpoint_request;
+
+    /* PRINT output, see out_flush() */
+    char out_buf[OUT_BUF_SIZE];
+    int out_len;
+    int out_unbuffered;
+    BasicWriteFn write;
+    void* write_user;
+
+    /* INPUT source, see input_number() */
+    BasicReadFn read;
+    void* read_user;
+    char* input_buf;                /* INPUT_BUF_SIZE bytes, allocated by the first INPUT */
+    int input_pos, input_len;
+
+    /* Parser state for current line */
+    const char* parse_ptr;
+
+    /* Compiler scratch: code under construction, jump fixups, expression trees */
+    int* code_buf;
+    int code_buf_len, code_buf_cap;
+    int stack_depth, stack_max;     /* value stack use while compiling */
+    struct Node* nodes;
+    int num_nodes, nodes_cap;
+    int optimize;                   /* OPTIMIZE ON|OFF: run fold() on expression trees */
+    int profile;                    /* PROFILE ON|OFF: compile with OP_LINE, report after RUN */
+    struct Profile* prof;
+    int trace;                      /* TRACE ON|OFF: compile with OP_TRACE */
+    unsigned int trace_vars;        /* bit v: record writes to vars[v] */
+    const char* trace_file;         /* save the trace here after every run, see -trace */
+    struct Trace* trace_buf;
+
+    /* Native code tier, see jit_compile() */
+    int jit_enabled;                /* JIT ON|OFF */
+    int* jit_count;                 /* per code offset: hit count, -1 - entry, or JIT_NEVER */
+    struct JitEntry* jit_entries;
+    int num_jit_entries, jit_entries_cap;
+    unsigned char* jb;              /* machine code under construction */
+    int jb_len, jb_cap;
+    struct JitFix* jfix;            /* pending rel32 fixups */
+    int jfix_len, jfix_cap;
+    signed char jit_reg[NUM_VARS + NUM_TEMPS];  /* register holding each variable in the region, or -1 */
+
+    /* PARALLEL FOR, see par_for() */
+    int par_threads;                /* threads to use, 0 = one per processor */
+    Interp* par_parent;             /* the run this worker runs a chunk of, or NULL */
+    int par_line;                   /* ... for the PARALLEL FOR on this line */
+};
+
+/*
+ * PRINT output goes through one buffer handed to the output callback
+ * (stdout by default) in large writes. It is flushed when full, at the end
+ * of a run and before each prompt. BUFFER OFF (the default when stdout is
+ * a terminal) also flushes after every printed line.
+ */
+static void write_file(void* user, const char* data, size_t len) {
+    fwrite(data, 1, len, (FILE*)user);
+}
+
+static void out_flush(Interp* in) {
+    if (in->out_len) in->write(in->write_user, in->out_buf, (size_t)in->out_len);
+    in->out_len = 0;
+    if (in->out_unbuffered && in->write == write_file) fflush((FILE*)in->write_user);
+}
+
+static void out_str(Interp* in, const char* s, int len) {
+    if (in->out_len + len > OUT_BUF_SIZE) {
+        out_flush(in);
+        if (len > OUT_BUF_SIZE) { in->write(in->write_user, s, (size_t)len); return; }
+    }
+    memcpy(in->out_buf + in->out_len, s, (size_t)len);
+    in->out_len += len;
+}
+
+static void out_char(Interp* in, int c) {
+    if (in->out_len == OUT_BUF_SIZE) out_flush(in);
+    in->out_buf[in->out_len++] = (char)c;
+    if (c == '\n' && in->out_unbuffered) out_flush(in);
+}
+
+static void out_int(Interp* in, int v) {
+    static const char digits2[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[12];
+    char* p = tmp + sizeof(tmp);
+    unsigned int u = v < 0 ? 0u - (unsigned int)v : (unsigned int)v;
+    while (u >= 100) {
+        unsigned int r = (u % 100) * 2;
+        u /= 100;
+        *--p = digits2[r + 1];
+        *--p = digits2[r];
+    }
+    if (u >= 10) {
+        *--p = digits2[u * 2 + 1];
+        *--p = digits2[u * 2];
+    } else {
+        *--p = (char)('0' + u);
+    }
+    if (v < 0) *--p = '-';
+    out_str(in, p, (int)(tmp + sizeof(tmp) - p));
+}
+
+/*
+ * INPUT reads integers from the input callback (stdin by default) through
+ * one buffer, refilled in large reads. A number is an optional minus sign
+ * and digits; any other byte only separates numbers, so values may come
+ * one per line, comma-separated or mixed with text. Pending output is
+ * flushed before each refill, so a prompt shows before INPUT waits.
+ */
+static size_t read_stream(void* user, char* buf, size_t len) {
+    FILE* f = (FILE*)user;
+    if (isatty(fileno(f))) return fgets(buf, (int)len, f) ? strlen(buf) : 0;
+    return fread(buf, 1, len, f);
+}
+
+static int input_fill(Interp* in) {
+    out_flush(in);
+    if (!in->input_buf) in->input_buf = (char*)malloc(INPUT_BUF_SIZE);
+    in->input_pos = 0;
+    in->input_len = in->read ? (int)in->read(in->read_user, in->input_buf, INPUT_BUF_SIZE) : 0;
+    return in->input_len > 0;
+}
+
+/* Next integer of the input into *out (wrapping like the arithmetic);
+   returns 0, or -1 at the end of input */
+static int input_number(Interp* in, int* out) {
+    unsigned int v = 0;
+    int neg = 0;
+    for (;;) {
+        int c;
+        if (in->input_pos == in->input_len && !input_fill(in)) return -1;
+        c = (unsigned char)in->input_buf[in->input_pos];
+        if (isdigit(c)) break;
+        neg = c == '-';
+        in->input_pos++;
+    }
+    for (;;) {
+        int c;
+        if (in->input_pos == in->input_len && !input_fill(in)) break;
+        c = (unsigned char)in->input_buf[in->input_pos];
+        if (!isdigit(c)) break;
+        v = v * 10 + (unsigned int)(c - '0');
+        in->input_pos++;
+    }
+    *out = (int)(neg ? 0u - v : v);
+    return 0;
+}
+
+/* READ: the next DATA value into *out; returns 0, or -1 past the last one */
+static int read_data(Interp* in, int* out) {
+    const Program* prog = in->prog;
+    if (in->data_pos >= prog->data_len) return -1;
+    *out = prog->data[in->data_pos++];
+    return 0;
+}
+
+/* Offset in the DATA pool of the first value at or after line number num */
+static int data_offset(const Program* prog, int num) {
+    int lo = 0, hi = prog->num_lines;
+    if (!prog->line_data) return 0;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (prog->lines[mid].num < num) lo = mid + 1;
+        else hi = mid;
+    }
+    return prog->line_data[lo];
+}
+
+/*
+ * Arrays. Up to ARRAY_MAP_MIN elements come from the heap; larger ones
+ * get address space of their own, mapped zero-filled so that the system
+ * only provides a page when it is first written (on Windows the memory is
+ * committed up front, but pages are still materialized on first touch).
+ * A sparse array of tens of millions of cells costs only the pages it
+ * uses. The blocks survive RUN: a DIM of the same size reuses the block,
+ * handing mapped pages back to the system instead of clearing them.
+ */
+static int* map_array(size_t bytes) {
+#ifdef _WIN32
+    return (int*)VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return p == MAP_FAILED ? NULL : (int*)p;
+#endif
+}
+
+static void unmap_array(int* mem, size_t bytes) {
+#ifdef _WIN32
+    (void)bytes;
+    VirtualFree(mem, 0, MEM_RELEASE);
+#else
+    munmap(mem, bytes);
+#endif
+}
+
+/* Zero a mapped array by replacing its pages with fresh demand-zero ones */
+static int rezero_array(int* mem, size_t bytes) {
+#ifdef _WIN32
+    return VirtualFree(mem, bytes, MEM_DECOMMIT) && VirtualAlloc(mem, bytes, MEM_COMMIT, PAGE_READWRITE);
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    return mmap(mem, bytes, PROT_READ | PROT_WRITE, flags, -1, 0) != MAP_FAILED;
+#endif
+}
+
+static void free_array_block(ArrayBlock* b) {
+    if (!b->mem) return;
+    if (b->mapped) unmap_array(b->mem, (size_t)b->size * sizeof(int));
+    else free(b->mem);
+    b->mem = NULL;
+    b->size = 0;
+}
+
+/* Point block b at n zeroed elements, reusing its memory if the size matches */
+static int* alloc_array_block(ArrayBlock* b, int n) {
+    size_t bytes = (size_t)n * sizeof(int);
+    if (b->mem && b->size == n) {
+        if (!b->mapped) memset(b->mem, 0, bytes);
+        else if (!rezero_array(b->mem, bytes)) free_array_block(b);
+        if (b->mem) return b->mem;
+    }
+    free_array_block(b);
+    b->mapped = n > ARRAY_MAP_MIN;
+    b->mem = b->mapped ? map_array(bytes) : (int*)calloc((size_t)n, sizeof(int));
+    if (b->mem) b->size = n;
+    return b->mem;
+}
+
+/* DIM v(n): replace arrays[v] with n zeroed elements. A size below 1 is
+   ignored. Returns BASIC_MEMORY_LIMIT if the arrays would then exceed
+   max_array_bytes or the memory cannot be had. */
+static int dim_array(Interp* in, int v, int n) {
+    long long bytes;
+    if (n <= 0) return BASIC_OK;
+    bytes = in->array_bytes + ((long long)n - in->array_sizes[v]) * (long long)sizeof(int);
+    if ((in->max_array_bytes && bytes > in->max_array_bytes) || (size_t)n > (size_t)-1 / sizeof(int)) {
+        return BASIC_MEMORY_LIMIT;
+    }
+    in->array_bytes -= (long long)in->array_sizes[v] * (long long)sizeof(int);
+    in->arrays[v] = NULL;
+    in->array_sizes[v] = 0;
+    if (!alloc_array_block(&in->array_blocks[v], n)) return BASIC_MEMORY_LIMIT;
+    in->arrays[v] = in->array_blocks[v].mem;
+    in->array_sizes[v] = n;
+    in->array_bytes = bytes;
+    return BASIC_OK;
+}
+
+/*
+ * Whole-array kernels for MAT. d[i] = a[i] op b[i], or a[i] op k when b is
+ * NULL, with the wrapping arithmetic of the VM. The vector loops cover
+ * whole registers and mat_scalar() finishes the tail; d may be a or b.
+ * AVX2 is chosen at run time on x86-64, SSE2 and NEON are baseline there
+ * and on AArch64, and other targets use mat_scalar() alone.
+ */
+enum { MAT_COPY, MAT_ADD, MAT_SUB, MAT_MUL, MAT_RSUB };     /* RSUB: k - a[i] */
+
+typedef void (*MatKernel)(int op, int* d, const int* a, const int* b, int k, size_t n);
+
+static int mat_apply(int op, int x, int y) {
+    unsigned int u = (unsigned int)x, v = (unsigned int)y;
+    switch (op) {
+    case MAT_ADD: return (int)(u + v);
+    case MAT_SUB: return (int)(u - v);
+    case MAT_MUL: return (int)(u * v);
+    case MAT_RSUB: return (int)(v - u);
+    default: return x;
+    }
+}
+
+static void mat_scalar(int op, int* d, const int* a, const int* b, int k, size_t n) {
+    for (size_t i = 0; i < n; i++) d[i] = mat_apply(op, a[i], b ? b[i] : k);
+}
+
+static unsigned int mat_sum_scalar(const int* a, size_t n) {
+    unsigned int s = 0;
+    for (size_t i = 0; i < n; i++) s += (unsigned int)a[i];
+    return s;
+}
+
+/* A kernel and a sum for one instruction set, from its W-lane load, store,
+   broadcast, add, sub and multiply */
+#define MAT_KERNELS(isa, attr, V, W, load, store, splat, add, sub, mul) \
+    static attr void mat_##isa(int op, int* d, const int* a, const int* b, int k, size_t n) { \
+        size_t i = 0; \
+        V kv = splat(k); \
+        if (b) { \
+            switch (op) { \
+            case MAT_ADD: for (; i + W <= n; i += W) store(d + i, add(load(a + i), load(b + i))); break; \
+            case MAT_SUB: for (; i + W <= n; i += W) store(d + i, sub(load(a + i), load(b + i))); break; \
+            case MAT_MUL: for (; i + W <= n; i += W) store(d + i, mul(load(a + i), load(b + i))); break; \
+            } \
+        } else { \
+            switch (op) { \
+            case MAT_ADD: for (; i + W <= n; i += W) store(d + i, add(load(a + i), kv)); break; \
+            case MAT_SUB: for (; i + W <= n; i += W) store(d + i, sub(load(a + i), kv)); break; \
+            case MAT_MUL: for (; i + W <= n; i += W) store(d + i, mul(load(a + i), kv)); break; \
+            case MAT_RSUB: for (; i + W <= n; i += W) store(d + i, sub(kv, load(a + i))); break; \
+            } \
+        } \
+        mat_scalar(op, d + i, a + i, b ? b + i : NULL, k, n - i); \
+    } \
+    static attr unsigned int mat_sum_##isa(const int* a, size_t n) { \
+        size_t i = 0; \
+        int lanes[W]; \
+        V s = splat(0); \
+        unsigned int total; \
+        for (; i + W <= n; i += W) s = add(s, load(a + i)); \
+        store(lanes, s); \
+        total = mat_sum_scalar(lanes, W); \
+        return total + mat_sum_scalar(a + i, n - i); \
+    }
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MAT_SSE2 1
+#define sse2_load(p)        _mm_loadu_si128((const __m128i*)(p))
+#define sse2_store(p, v)    _mm_storeu_si128((__m128i*)(p), v)
+
+/* SSE2 has no 32-bit multiply: multiply even and odd lanes as 64-bit */
+static __m128i sse2_mul(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
 
-/* Variables A-Z (index 0 = A, 25 = Z) */
-static int vars[NUM_VARS];
+MAT_KERNELS(sse2, , __m128i, 4, sse2_load, sse2_store, _mm_set1_epi32, _mm_add_epi32, _mm_sub_epi32, sse2_mul)
+#endif
 
-/* Arrays: ptr to data, size (0 = not dimensioned) */
-static int* arrays[NUM_VARS];
-static int array_sizes[NUM_VARS];
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <immintrin.h>
+#define MAT_AVX2 1
+#define avx2_load(p)        _mm256_loadu_si256((const __m256i*)(p))
+#define avx2_store(p, v)    _mm256_storeu_si256((__m256i*)(p), v)
+MAT_KERNELS(avx2, __attribute__((target("avx2"))), __m256i, 8, avx2_load, avx2_store,
+            _mm256_set1_epi32, _mm256_add_epi32, _mm256_sub_epi32, _mm256_mullo_epi32)
+#endif
 
-/* Runtime: current line index when running */
-static int run_index = -1;
-static int run_mode = 0;  /* 0 = idle, 1 = running */
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MAT_NEON 1
+#define neon_store(p, v)    vst1q_s32(p, v)
+MAT_KERNELS(neon, , int32x4_t, 4, vld1q_s32, neon_store, vdupq_n_s32, vaddq_s32, vsubq_s32, vmulq_s32)
+#endif
+
+static MatKernel mat_kernel(void) {
+#ifdef MAT_AVX2
+    if (__builtin_cpu_supports("avx2")) return mat_avx2;
+#endif
+#if defined(MAT_SSE2)
+    return mat_sse2;
+#elif defined(MAT_NEON)
+    return mat_neon;
+#else
+    return mat_scalar;
+#endif
+}
+
+static unsigned int mat_sum_kernel(const int* a, size_t n) {
+#ifdef MAT_AVX2
+    if (__builtin_cpu_supports("avx2")) return mat_sum_avx2(a, n);
+#endif
+#if defined(MAT_SSE2)
+    return mat_sum_sse2(a, n);
+#elif defined(MAT_NEON)
+    return mat_sum_neon(a, n);
+#else
+    return mat_sum_scalar(a, n);
+#endif
+}
+
+/* Elements of array a from index i on, or NULL past its end (or if a is a
+   scalar operand); lowers *end to where the elements run out */
+static const int* mat_operand(const Interp* in, int a, int i, int* end) {
+    if (a < 0 || !in->arrays[a] || i >= in->array_sizes[a]) return NULL;
+    if (in->array_sizes[a] < *end) *end = in->array_sizes[a];
+    return in->arrays[a] + i;
+}
+
+/*
+ * MAT d = x op y: the same as LET D(I) = X(I) op Y(I) for every element of
+ * d, so elements past the end of a shorter source read 0. x and y name
+ * arrays, or are -1 for the scalars xk and yk; op MAT_COPY has no y. An
+ * undimensioned d is left alone. The work is split where sources run out,
+ * so each piece is one kernel call, a copy or a fill; filling a mapped
+ * array with 0 hands its pages back instead.
+ */
+static void mat_assign(Interp* in, int d, int x, int xk, int op, int y, int yk) {
+    MatKernel kernel = mat_kernel();
+    int* dst = in->arrays[d];
+    int n = in->array_sizes[d], end;
+    if (!dst) return;
+    if (op == MAT_COPY) y = -1;
+    for (int i = 0; i < n; i = end) {
+        const int* a, * b;
+        size_t len;
+        end = n;
+        a = mat_operand(in, x, i, &end);
+        b = op == MAT_COPY ? NULL : mat_operand(in, y, i, &end);
+        len = (size_t)(end - i);
+        if (a && b) {
+            kernel(op, dst + i, a, b, 0, len);
+        } else if (a && op == MAT_COPY) {
+            if (a != dst + i) memmove(dst + i, a, len * sizeof(int));
+        } else if (a) {
+            kernel(op, dst + i, a, NULL, y < 0 ? yk : 0, len);
+        } else if (b) {
+            kernel(op == MAT_SUB ? MAT_RSUB : op, dst + i, b, NULL, x < 0 ? xk : 0, len);
+        } else {
+            ArrayBlock* blk = &in->array_blocks[d];
+            int v = mat_apply(op, x < 0 ? xk : 0, y < 0 ? yk : 0);
+            if (v == 0 && i == 0 && blk->mapped && rezero_array(dst, len * sizeof(int))) continue;
+            for (size_t j = 0; j < len; j++) dst[i + j] = v;
+        }
+    }
+}
 
-/* Parser state for current line */
-static const char* parse_ptr = NULL;
+/* MAT SUM: the wrapping sum of array a, 0 if undimensioned */
+static int mat_sum(const Interp* in, int a) {
+    if (!in->arrays[a]) return 0;
+    return (int)mat_sum_kernel(in->arrays[a], (size_t)in->array_sizes[a]);
+}
 
-static void skip_spaces(void) {
-    while (*parse_ptr == ' ' || *parse_ptr == '\t') parse_ptr++;
+static void skip_spaces(Interp* in) {
+    while (*in->parse_ptr == ' ' || *in->parse_ptr == '\t') in->parse_ptr++;
 }
 
-static int parse_number(int* out) {
-    skip_spaces();
-    if (!isdigit((unsigned char)*parse_ptr)) return -1;
+static int parse_number(Interp* in, int* out) {
+    skip_spaces(in);
+    if (!isdigit((unsigned char)*in->parse_ptr)) return -1;
     *out = 0;
-    while (isdigit((unsigned char)*parse_ptr)) {
-        *out = *out * 10 + (*parse_ptr - '0');
-        parse_ptr++;
+    while (isdigit((unsigned char)*in->parse_ptr)) {
+        *out = *out * 10 + (*in->parse_ptr - '0');
+        in->parse_ptr++;
     }
     return 0;
 }
 
 /* Parse a variable name (single letter A-Z), return index 0-25 or -1 */
-static int parse_var(void) {
-    skip_spaces();
-    if (*parse_ptr >= 'A' && *parse_ptr <= 'Z') {
-        int i = *parse_ptr - 'A';
-        parse_ptr++;
+static int parse_var(Interp* in) {
+    skip_spaces(in);
+    if (*in->parse_ptr >= 'A' && *in->parse_ptr <= 'Z') {
+        int i = *in->parse_ptr - 'A';
+        in->parse_ptr++;
         return i;
     }
     return -1;
 }
 
 /* Evaluate expression: integers, variables, array refs, + - * / ( ) */
-static int eval_expr(void);
-
-static int eval_primary(void) {
-    skip_spaces();
-    if (*parse_ptr == '(') {
-        parse_ptr++;
-        int v = eval_expr();
-        skip_spaces();
-        if (*parse_ptr == ')') parse_ptr++;
+static int eval_expr(Interp* in);
+
+static int eval_primary(Interp* in) {
+    skip_spaces(in);
+    if (*in->parse_ptr == '(') {
+        in->parse_ptr++;
+        int v = eval_expr(in);
+        skip_spaces(in);
+        if (*in->parse_ptr == ')') in->parse_ptr++;
         return v;
     }
-    if (*parse_ptr == '-') {
-        parse_ptr++;
-        return -eval_primary();
+    if (*in->parse_ptr == '-') {
+        in->parse_ptr++;
+        return -eval_primary(in);
     }
-    if (isdigit((unsigned char)*parse_ptr)) {
+    if (isdigit((unsigned char)*in->parse_ptr)) {
         int n = 0;
-        while (isdigit((unsigned char)*parse_ptr)) {
-            n = n * 10 + (*parse_ptr - '0');
-            parse_ptr++;
+        while (isdigit((unsigned char)*in->parse_ptr)) {
+            n = n * 10 + (*in->parse_ptr - '0');
+            in->parse_ptr++;
         }
         return n;
     }
     /* Variable or array */
-    int vi = parse_var();
+    int vi = parse_var(in);
     if (vi < 0) return 0;
-    skip_spaces();
-    if (*parse_ptr == '(') {
-        parse_ptr++;
-        int idx = eval_expr();
-        skip_spaces();
-        if (*parse_ptr == ')') parse_ptr++;
-        if (arrays[vi] && idx >= 0 && idx < array_sizes[vi])
-            return arrays[vi][idx];
+    skip_spaces(in);
+    if (*in->parse_ptr == '(') {
+        in->parse_ptr++;
+        int idx = eval_expr(in);
+        skip_spaces(in);
+        if (*in->parse_ptr == ')') in->parse_ptr++;
+        if (in->arrays[vi] && idx >= 0 && idx < in->array_sizes[vi])
+            return in->arrays[vi][idx];
         return 0;
     }
-    return vars[vi];
+    return in->vars[vi];
 }
 
-static int eval_term(void) {
-    int v = eval_primary();
-    skip_spaces();
+static int eval_term(Interp* in) {
+    int v = eval_primary(in);
+    skip_spaces(in);
     for (;;) {
-        if (*parse_ptr == '*') {
-            parse_ptr++;
-            v *= eval_primary();
-        } else if (*parse_ptr == '/') {
-            parse_ptr++;
-            int r = eval_primary();
+        if (*in->parse_ptr == '*') {
+            in->parse_ptr++;
+            v *= eval_primary(in);
+        } else if (*in->parse_ptr == '/') {
+            in->parse_ptr++;
+            int r = eval_primary(in);
             v = (r != 0) ? v / r : 0;
         } else break;
-        skip_spaces();
+        skip_spaces(in);
     }
     return v;
 }
 
-static int eval_expr(void) {
-    int v = eval_term();
-    skip_spaces();
+static int eval_expr(Interp* in) {
+    int v = eval_term(in);
+    skip_spaces(in);
     for (;;) {
-        if (*parse_ptr == '+') {
-            parse_ptr++;
-            v += eval_term();
-        } else if (*parse_ptr == '-') {
-            parse_ptr++;
-            v -= eval_term();
+        if (*in->parse_ptr == '+') {
+            in->parse_ptr++;
+            v += eval_term(in);
+        } else if (*in->parse_ptr == '-') {
+            in->parse_ptr++;
+            v -= eval_term(in);
         } else break;
-        skip_spaces();
+        skip_spaces(in);
     }
     return v;
 }
@@ -139,22 +736,22 @@ static int eval_expr(void) {
 /* Compare: =, <>, <, >, <=, >= */
 enum { CMP_EQ, CMP_NE, CMP_LT, CMP_GT, CMP_LE, CMP_GE };
 
-static int parse_compare(int* cmp) {
-    skip_spaces();
-    if (parse_ptr[0] == '=' && parse_ptr[1] != '=') { *cmp = CMP_EQ; parse_ptr += 1; return 0; }
-    if (parse_ptr[0] == '<' && parse_ptr[1] == '>') { *cmp = CMP_NE; parse_ptr += 2; return 0; }
-    if (parse_ptr[0] == '<' && parse_ptr[1] == '=') { *cmp = CMP_LE; parse_ptr += 2; return 0; }
-    if (parse_ptr[0] == '>' && parse_ptr[1] == '=') { *cmp = CMP_GE; parse_ptr += 2; return 0; }
-    if (parse_ptr[0] == '<') { *cmp = CMP_LT; parse_ptr += 1; return 0; }
-    if (parse_ptr[0] == '>') { *cmp = CMP_GT; parse_ptr += 1; return 0; }
+static int parse_compare(Interp* in, int* cmp) {
+    skip_spaces(in);
+    if (in->parse_ptr[0] == '=' && in->parse_ptr[1] != '=') { *cmp = CMP_EQ; in->parse_ptr += 1; return 0; }
+    if (in->parse_ptr[0] == '<' && in->parse_ptr[1] == '>') { *cmp = CMP_NE; in->parse_ptr += 2; return 0; }
+    if (in->parse_ptr[0] == '<' && in->parse_ptr[1] == '=') { *cmp = CMP_LE; in->parse_ptr += 2; return 0; }
+    if (in->parse_ptr[0] == '>' && in->parse_ptr[1] == '=') { *cmp = CMP_GE; in->parse_ptr += 2; return 0; }
+    if (in->parse_ptr[0] == '<') { *cmp = CMP_LT; in->parse_ptr += 1; return 0; }
+    if (in->parse_ptr[0] == '>') { *cmp = CMP_GT; in->parse_ptr += 1; return 0; }
     return -1;
 }
 
-static int eval_condition(void) {
-    int left = eval_expr();
+static int eval_condition(Interp* in) {
+    int left = eval_expr(in);
     int cmp;
-    if (parse_compare(&cmp) != 0) return 0;
-    int right = eval_expr();
+    if (parse_compare(in, &cmp) != 0) return 0;
+    int right = eval_expr(in);
     switch (cmp) {
         case CMP_EQ: return left == right;
         case CMP_NE: return left != right;
@@ -166,324 +763,5871 @@ static int eval_condition(void) {
     }
 }
 
+/* MAT statements name arrays by letter; see mat_assign(). After MAT:
+   'F' for FILL, 'S' for SUM or 0 for an assignment, skipping the word. */
+static int mat_form(Interp* in) {
+    if (strncmp(in->parse_ptr, "FILL", 4) == 0 && (in->parse_ptr[4] == ' ' || in->parse_ptr[4] == '\t')) {
+        in->parse_ptr += 4;
+        return 'F';
+    }
+    if (strncmp(in->parse_ptr, "SUM", 3) == 0 && (in->parse_ptr[3] == ' ' || in->parse_ptr[3] == '\t')) {
+        in->parse_ptr += 3;
+        return 'S';
+    }
+    return 0;
+}
+
+/* Operator between MAT operands, MAT_COPY if there is none */
+static int mat_op(Interp* in) {
+    skip_spaces(in);
+    switch (*in->parse_ptr) {
+    case '+': in->parse_ptr++; return MAT_ADD;
+    case '-': in->parse_ptr++; return MAT_SUB;
+    case '*': in->parse_ptr++; return MAT_MUL;
+    default: return MAT_COPY;
+    }
+}
+
+/* Index of line number num in a sorted line array, or -1 if absent */
+static int find_line(const Line* lines, int total_lines, int num) {
+    int lo = 0, hi = total_lines - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (lines[mid].num == num) return mid;
+        if (lines[mid].num < num) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+/*
+ * FOR and GOSUB share one control stack. As in Microsoft BASIC, a FOR body
+ * runs at least once, FOR on a variable that is already looping restarts
+ * that loop, and NEXT and RETURN discard the frames above the one they
+ * use. NEXT without a FOR and RETURN without a GOSUB do nothing.
+ */
+
+/* Innermost FOR frame for var (any variable if var < 0) above the
+   innermost GOSUB, or -1 */
+static int ctrl_find_for(const Interp* in, int var) {
+    for (int i = in->ctrl_sp - 1; i >= 0 && in->ctrl[i].var >= 0; i--) {
+        if (var < 0 || in->ctrl[i].var == var) return i;
+    }
+    return -1;
+}
+
+static int ctrl_push(Interp* in, int var, int limit, int step, int pc) {
+    CtrlFrame* f;
+    if (in->ctrl_sp == CTRL_DEPTH) return BASIC_STACK_OVERFLOW;
+    f = &in->ctrl[in->ctrl_sp++];
+    f->var = var;
+    f->limit = limit;
+    f->step = step;
+    f->pc = pc;
+    return BASIC_OK;
+}
+
+/* FOR var = ... TO limit STEP step, after var was set; pc = the body */
+static int ctrl_for(Interp* in, int var, int limit, int step, int pc) {
+    int i = ctrl_find_for(in, var);
+    if (i >= 0) in->ctrl_sp = i;
+    return ctrl_push(in, var, limit, step, pc);
+}
+
+/* NEXT var (var < 0: the innermost loop). Returns where the body starts
+   if the loop goes on, else -1 to continue after the NEXT. */
+static int ctrl_next(Interp* in, int var) {
+    int i = ctrl_find_for(in, var);
+    const CtrlFrame* f;
+    long long v;
+    if (i < 0) return -1;
+    f = &in->ctrl[i];
+    v = (long long)in->vars[f->var] + f->step;
+    in->vars[f->var] = (int)(unsigned int)v;
+    if (f->step >= 0 ? v <= f->limit : v >= f->limit) {
+        in->ctrl_sp = i + 1;
+        return f->pc;
+    }
+    in->ctrl_sp = i;
+    return -1;
+}
+
+/* RETURN: where the innermost GOSUB continues, or -1 if there is none */
+static int ctrl_return(Interp* in) {
+    for (int i = in->ctrl_sp - 1; i >= 0; i--) {
+        if (in->ctrl[i].var < 0) {
+            in->ctrl_sp = i;
+            return in->ctrl[i].pc;
+        }
+    }
+    return -1;
+}
+
+static void compile_program(Interp* in);
+
+/* Link the program if it changed, so a direct READ or RESTORE sees its
+   DATA pool; keeps parse_ptr */
+static void data_ready(Interp* in) {
+    const char* p = in->parse_ptr;
+    if (in->prog->num_lines && !in->prog->code_valid && !in->prog_shared) compile_program(in);
+    in->parse_ptr = p;
+}
+
 /* Execute one program line; text = line source. Returns next line index or -1 to stop. */
-static int execute_line_text(const char* text, int current_index, int total_lines, Line* lines) {
-    parse_ptr = text;
-    skip_spaces();
+static int execute_line_text(Interp* in, const char* text, int current_index, int total_lines, Line* lines) {
+    in->parse_ptr = text;
+    skip_spaces(in);
 
     /* PRINT [expr|"string"] [, ...] */
-    if (strncmp(parse_ptr, "PRINT", 5) == 0 && (parse_ptr[5] == ' ' || parse_ptr[5] == '\t' || parse_ptr[5] == '\0')) {
-        parse_ptr += 5;
+    if (strncmp(in->parse_ptr, "PRINT", 5) == 0 && (in->parse_ptr[5] == ' ' || in->parse_ptr[5] == '\t' || in->parse_ptr[5] == '\0')) {
+        in->parse_ptr += 5;
         for (;;) {
-            skip_spaces();
-            if (!*parse_ptr || *parse_ptr == '\n') break;
-            if (*parse_ptr == '"') {
-                parse_ptr++;
-                while (*parse_ptr && *parse_ptr != '"') { putchar(*parse_ptr); parse_ptr++; }
-                if (*parse_ptr == '"') parse_ptr++;
+            skip_spaces(in);
+            if (!*in->parse_ptr || *in->parse_ptr == '\n') break;
+            if (*in->parse_ptr == '"') {
+                in->parse_ptr++;
+                const char* s = in->parse_ptr;
+                while (*in->parse_ptr && *in->parse_ptr != '"') in->parse_ptr++;
+                out_str(in, s, (int)(in->parse_ptr - s));
+                if (*in->parse_ptr == '"') in->parse_ptr++;
             } else {
-                printf("%d", eval_expr());
+                out_int(in, eval_expr(in));
             }
-            skip_spaces();
-            if (*parse_ptr == ',') { parse_ptr++; putchar(' '); continue; }
+            skip_spaces(in);
+            if (*in->parse_ptr == ',') { in->parse_ptr++; out_char(in, ' '); continue; }
             break;
         }
-        putchar('\n');
+        out_char(in, '\n');
         return current_index + 1;
     }
 
     /* LET var = expr  or  LET A(i) = expr */
-    if (strncmp(parse_ptr, "LET", 3) == 0 && (parse_ptr[3] == ' ' || parse_ptr[3] == '\t')) {
-        parse_ptr += 3;
-        skip_spaces();
-        int vi = parse_var();
+    if (strncmp(in->parse_ptr, "LET", 3) == 0 && (in->parse_ptr[3] == ' ' || in->parse_ptr[3] == '\t')) {
+        in->parse_ptr += 3;
+        skip_spaces(in);
+        int vi = parse_var(in);
         if (vi < 0) return current_index + 1;
-        skip_spaces();
-        if (*parse_ptr == '(') {
-            parse_ptr++;
-            int idx = eval_expr();
-            skip_spaces();
-            if (*parse_ptr == ')') parse_ptr++;
-            skip_spaces();
-            if (*parse_ptr == '=') parse_ptr++;
-            skip_spaces();
-            if (arrays[vi] && idx >= 0 && idx < array_sizes[vi])
-                arrays[vi][idx] = eval_expr();
+        skip_spaces(in);
+        if (*in->parse_ptr == '(') {
+            in->parse_ptr++;
+            int idx = eval_expr(in);
+            skip_spaces(in);
+            if (*in->parse_ptr == ')') in->parse_ptr++;
+            skip_spaces(in);
+            if (*in->parse_ptr == '=') in->parse_ptr++;
+            skip_spaces(in);
+            if (in->arrays[vi] && idx >= 0 && idx < in->array_sizes[vi])
+                in->arrays[vi][idx] = eval_expr(in);
         } else {
-            skip_spaces();
-            if (*parse_ptr == '=') parse_ptr++;
-            skip_spaces();
-            vars[vi] = eval_expr();
+            skip_spaces(in);
+            if (*in->parse_ptr == '=') in->parse_ptr++;
+            skip_spaces(in);
+            in->vars[vi] = eval_expr(in);
         }
         return current_index + 1;
     }
 
     /* GOTO num */
-    if (strncmp(parse_ptr, "GOTO", 4) == 0 && (parse_ptr[4] == ' ' || parse_ptr[4] == '\t')) {
-        parse_ptr += 4;
+    if (strncmp(in->parse_ptr, "GOTO", 4) == 0 && (in->parse_ptr[4] == ' ' || in->parse_ptr[4] == '\t')) {
+        in->parse_ptr += 4;
         int target;
-        if (parse_number(&target) != 0) return current_index + 1;
-        for (int i = 0; i < total_lines; i++) {
-            if (lines[i].num == target) return i;
-        }
-        return current_index + 1;
+        if (parse_number(in, &target) != 0) return current_index + 1;
+        int i = find_line(lines, total_lines, target);
+        return i >= 0 ? i : current_index + 1;
     }
 
     /* IF condition THEN GOTO num  or  IF condition THEN num */
-    if (strncmp(parse_ptr, "IF", 2) == 0 && (parse_ptr[2] == ' ' || parse_ptr[2] == '\t')) {
-        parse_ptr += 2;
-        int cond = eval_condition();
-        skip_spaces();
-        if (strncmp(parse_ptr, "THEN", 4) == 0) parse_ptr += 4;
-        skip_spaces();
+    if (strncmp(in->parse_ptr, "IF", 2) == 0 && (in->parse_ptr[2] == ' ' || in->parse_ptr[2] == '\t')) {
+        in->parse_ptr += 2;
+        int cond = eval_condition(in);
+        skip_spaces(in);
+        if (strncmp(in->parse_ptr, "THEN", 4) == 0) in->parse_ptr += 4;
+        skip_spaces(in);
         if (cond) {
             int target;
-            if (parse_number(&target) != 0) return current_index + 1;
-            for (int i = 0; i < total_lines; i++) {
-                if (lines[i].num == target) return i;
-            }
+            if (parse_number(in, &target) != 0) return current_index + 1;
+            int i = find_line(lines, total_lines, target);
+            if (i >= 0) return i;
+        }
+        return current_index + 1;
+    }
+
+    /* PARALLEL FOR runs as a plain FOR here, see par_for() */
+    if (strncmp(in->parse_ptr, "PARALLEL", 8) == 0 && (in->parse_ptr[8] == ' ' || in->parse_ptr[8] == '\t')) {
+        in->parse_ptr += 8;
+        skip_spaces(in);
+        if (strncmp(in->parse_ptr, "FOR", 3) != 0 || (in->parse_ptr[3] != ' ' && in->parse_ptr[3] != '\t')) return current_index + 1;
+    }
+
+    /* FOR var = expr TO expr [STEP expr] */
+    if (strncmp(in->parse_ptr, "FOR", 3) == 0 && (in->parse_ptr[3] == ' ' || in->parse_ptr[3] == '\t')) {
+        in->parse_ptr += 3;
+        skip_spaces(in);
+        int vi = parse_var(in);
+        if (vi < 0) return current_index + 1;
+        skip_spaces(in);
+        if (*in->parse_ptr == '=') in->parse_ptr++;
+        in->vars[vi] = eval_expr(in);
+        skip_spaces(in);
+        if (strncmp(in->parse_ptr, "TO", 2) == 0) in->parse_ptr += 2;
+        int limit = eval_expr(in), step = 1;
+        skip_spaces(in);
+        if (strncmp(in->parse_ptr, "STEP", 4) == 0) {
+            in->parse_ptr += 4;
+            step = eval_expr(in);
         }
+        if (ctrl_for(in, vi, limit, step, current_index + 1) != BASIC_OK) return -1;
         return current_index + 1;
     }
 
+    /* NEXT [var] */
+    if (strncmp(in->parse_ptr, "NEXT", 4) == 0 && (in->parse_ptr[4] == ' ' || in->parse_ptr[4] == '\t' || in->parse_ptr[4] == '\0')) {
+        in->parse_ptr += 4;
+        int i = ctrl_next(in, parse_var(in));
+        return i >= 0 ? i : current_index + 1;
+    }
+
+    /* GOSUB num */
+    if (strncmp(in->parse_ptr, "GOSUB", 5) == 0 && (in->parse_ptr[5] == ' ' || in->parse_ptr[5] == '\t')) {
+        in->parse_ptr += 5;
+        int target;
+        if (parse_number(in, &target) != 0) return current_index + 1;
+        int i = find_line(lines, total_lines, target);
+        if (i < 0) return current_index + 1;
+        if (ctrl_push(in, -1, 0, 0, current_index + 1) != BASIC_OK) return -1;
+        return i;
+    }
+
+    /* RETURN */
+    if (strncmp(in->parse_ptr, "RETURN", 6) == 0 && (in->parse_ptr[6] == ' ' || in->parse_ptr[6] == '\t' || in->parse_ptr[6] == '\0' || in->parse_ptr[6] == '\n')) {
+        int i = ctrl_return(in);
+        return i >= 0 ? i : current_index + 1;
+    }
+
     /* END */
-    if (strncmp(parse_ptr, "END", 3) == 0 && (parse_ptr[3] == ' ' || parse_ptr[3] == '\t' || parse_ptr[3] == '\0' || parse_ptr[3] == '\n')) {
+    if (strncmp(in->parse_ptr, "END", 3) == 0 && (in->parse_ptr[3] == ' ' || in->parse_ptr[3] == '\t' || in->parse_ptr[3] == '\0' || in->parse_ptr[3] == '\n')) {
         return -1;
     }
 
     /* DIM var(num) */
-    if (strncmp(parse_ptr, "DIM", 3) == 0 && (parse_ptr[3] == ' ' || parse_ptr[3] == '\t')) {
-        parse_ptr += 3;
-        skip_spaces();
-        int vi = parse_var();
+    if (strncmp(in->parse_ptr, "DIM", 3) == 0 && (in->parse_ptr[3] == ' ' || in->parse_ptr[3] == '\t')) {
+        in->parse_ptr += 3;
+        skip_spaces(in);
+        int vi = parse_var(in);
         if (vi >= 0) {
-            skip_spaces();
-            if (*parse_ptr == '(') {
-                parse_ptr++;
-                int sz = eval_expr();
-                skip_spaces();
-                if (*parse_ptr == ')') parse_ptr++;
-                if (sz > 0 && sz <= 65536) {
-                    if (arrays[vi]) free(arrays[vi]);
-                    arrays[vi] = (int*)calloc((size_t)sz, sizeof(int));
-                    array_sizes[vi] = sz;
-                }
+            skip_spaces(in);
+            if (*in->parse_ptr == '(') {
+                in->parse_ptr++;
+                int sz = eval_expr(in);
+                skip_spaces(in);
+                if (*in->parse_ptr == ')') in->parse_ptr++;
+                dim_array(in, vi, sz);
             }
         }
         return current_index + 1;
     }
 
-    return current_index + 1;
-}
-
-static int execute_line(int line_index) {
-    return execute_line_text(program[line_index].text, line_index, num_program_lines, program);
-}
-
-/* Sort program lines by line number */
-static void sort_program(void) {
-    for (int i = 0; i < num_program_lines - 1; i++) {
-        for (int j = i + 1; j < num_program_lines; j++) {
-            if (program[j].num < program[i].num) {
-                Line t = program[i];
-                program[i] = program[j];
-                program[j] = t;
+    /* MAT A = x [op y]  or  MAT FILL A = expr  or  MAT SUM var = A */
+    if (strncmp(in->parse_ptr, "MAT", 3) == 0 && (in->parse_ptr[3] == ' ' || in->parse_ptr[3] == '\t')) {
+        in->parse_ptr += 3;
+        skip_spaces(in);
+        int form = mat_form(in);
+        int d = parse_var(in);
+        if (d < 0) return current_index + 1;
+        skip_spaces(in);
+        if (*in->parse_ptr == '=') in->parse_ptr++;
+        skip_spaces(in);
+        if (form == 'F') {
+            mat_assign(in, d, -1, eval_expr(in), MAT_COPY, -1, 0);
+        } else if (form == 'S') {
+            int a = parse_var(in);
+            if (a >= 0) in->vars[d] = mat_sum(in, a);
+        } else {
+            int x, y = -1, xk = 0, yk = 0, op;
+            if ((x = parse_var(in)) < 0) xk = eval_primary(in);
+            op = mat_op(in);
+            if (op != MAT_COPY) {
+                skip_spaces(in);
+                if ((y = parse_var(in)) < 0) yk = eval_primary(in);
             }
+            mat_assign(in, d, x, xk, op, y, yk);
         }
+        return current_index + 1;
     }
-}
 
-/* Add or replace a line by number */
-static void add_line(int num, const char* text) {
-    /* Remove existing line with same number */
-    for (int i = 0; i < num_program_lines; i++) {
-        if (program[i].num == num) {
-            for (int k = i; k < num_program_lines - 1; k++)
-                program[k] = program[k + 1];
-            num_program_lines--;
-            break;
+    /* INPUT var[, var...]  or  READ var[, var...], where a var may be A(i) */
+    if ((strncmp(in->parse_ptr, "INPUT", 5) == 0 && (in->parse_ptr[5] == ' ' || in->parse_ptr[5] == '\t'))
+        || (strncmp(in->parse_ptr, "READ", 4) == 0 && (in->parse_ptr[4] == ' ' || in->parse_ptr[4] == '\t'))) {
+        int input = *in->parse_ptr == 'I';
+        data_ready(in);
+        in->parse_ptr += input ? 5 : 4;
+        for (;;) {
+            int vi = parse_var(in), elem = 0, idx = 0, v;
+            if (vi < 0) break;
+            skip_spaces(in);
+            if (*in->parse_ptr == '(') {
+                in->parse_ptr++;
+                idx = eval_expr(in);
+                skip_spaces(in);
+                if (*in->parse_ptr == ')') in->parse_ptr++;
+                elem = 1;
+            }
+            if ((input ? input_number(in, &v) : read_data(in, &v)) != 0) return -1;
+            if (!elem) in->vars[vi] = v;
+            else if (in->arrays[vi] && idx >= 0 && idx < in->array_sizes[vi]) in->arrays[vi][idx] = v;
+            skip_spaces(in);
+            if (*in->parse_ptr != ',') break;
+            in->parse_ptr++;
         }
+        return current_index + 1;
+    }
+
+    /* RESTORE [num]: READ goes on from the first DATA at or after line num */
+    if (strncmp(in->parse_ptr, "RESTORE", 7) == 0 && (in->parse_ptr[7] == ' ' || in->parse_ptr[7] == '\t' || in->parse_ptr[7] == '\0' || in->parse_ptr[7] == '\n')) {
+        int target;
+        data_ready(in);
+        in->parse_ptr += 7;
+        in->data_pos = parse_number(in, &target) == 0 ? data_offset(in->prog, target) : 0;
+        return current_index + 1;
     }
-    if (num_program_lines >= MAX_LINES) return;
-    program[num_program_lines].num = num;
-    strncpy(program[num_program_lines].text, text, MAX_LINELEN - 1);
-    program[num_program_lines].text[MAX_LINELEN - 1] = '\0';
-    num_program_lines++;
-    sort_program();
+
+    return current_index + 1;
 }
 
-static void clear_program(void) {
-    num_program_lines = 0;
+/*
+ * Tokenized program storage. Lines are crunched once when entered: the
+ * statement keyword, THEN, integer literals and string constants become
+ * single-byte tokens (>= 0x80) with little-endian operands; spaces,
+ * operators and variable letters (already their own index) stay verbatim,
+ * so detokenizing reproduces the source exactly. Digit runs that would not
+ * print back the same (leading zeros, overflow) are also left verbatim.
+ */
+enum {
+    TOK_BYTE = 0x80,  /* 1-byte integer literal 0-255 */
+    TOK_NUM,          /* 4-byte integer literal */
+    TOK_STR,          /* 4-byte string id, quoted string */
+    TOK_OPENSTR,      /* 4-byte string id, string missing its closing quote */
+    TOK_RAW,          /* source byte >= 0x80 follows */
+    TOK_PRINT, TOK_LET, TOK_GOTO, TOK_IF, TOK_THEN, TOK_END, TOK_DIM,
+    TOK_FOR, TOK_TO, TOK_STEP, TOK_NEXT, TOK_GOSUB, TOK_RETURN, TOK_MAT,
+    TOK_INPUT, TOK_DATA, TOK_READ, TOK_RESTORE, TOK_PARALLEL
+};
+
+static const char* const keyword_names[] = {
+    "PRINT", "LET", "GOTO", "IF", "THEN", "END", "DIM", "FOR", "TO", "STEP", "NEXT", "GOSUB", "RETURN", "MAT",
+    "INPUT", "DATA", "READ", "RESTORE", "PARALLEL"
+};
+
+static unsigned int hash_bytes(const char* s, int len) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
 }
 
-static void init_vars(void) {
-    for (int i = 0; i < NUM_VARS; i++) {
-        vars[i] = 0;
-        if (arrays[i]) { free(arrays[i]); arrays[i] = NULL; }
-        array_sizes[i] = 0;
-    }
+static void str_hash_insert(Program* prog, int id) {
+    unsigned int i = hash_bytes(prog->str_pool + prog->strs[id].off, prog->strs[id].len) & (unsigned int)(prog->str_hash_size - 1);
+    while (prog->str_hash[i]) i = (i + 1) & (unsigned int)(prog->str_hash_size - 1);
+    prog->str_hash[i] = id + 1;
 }
 
-static void do_run(void) {
-    if (num_program_lines == 0) {
-        printf("No program.\n");
-        return;
+static int intern_string(Program* prog, const char* s, int len) {
+    if (prog->str_hash_size) {
+        unsigned int i = hash_bytes(s, len) & (unsigned int)(prog->str_hash_size - 1);
+        while (prog->str_hash[i]) {
+            const StrRef* r = &prog->strs[prog->str_hash[i] - 1];
+            if (r->len == len && memcmp(prog->str_pool + r->off, s, (size_t)len) == 0) return prog->str_hash[i] - 1;
+            i = (i + 1) & (unsigned int)(prog->str_hash_size - 1);
+        }
+    }
+    if (prog->str_len + len > prog->str_cap) {
+        while (prog->str_len + len > prog->str_cap) prog->str_cap = prog->str_cap ? prog->str_cap * 2 : 256;
+        prog->str_pool = (char*)realloc(prog->str_pool, (size_t)prog->str_cap);
+    }
+    if (prog->num_strs == prog->strs_cap) {
+        prog->strs_cap = prog->strs_cap ? prog->strs_cap * 2 : 32;
+        prog->strs = (StrRef*)realloc(prog->strs, (size_t)prog->strs_cap * sizeof(StrRef));
     }
-    init_vars();
-    run_index = 0;
-    run_mode = 1;
-    while (run_index >= 0 && run_index < num_program_lines) {
-        run_index = execute_line(run_index);
+    memcpy(prog->str_pool + prog->str_len, s, (size_t)len);
+    prog->strs[prog->num_strs].off = prog->str_len;
+    prog->strs[prog->num_strs].len = len;
+    prog->str_len += len;
+    prog->num_strs++;
+    if (prog->num_strs * 2 > prog->str_hash_size) {
+        free(prog->str_hash);
+        prog->str_hash_size = prog->str_hash_size ? prog->str_hash_size * 2 : 64;
+        prog->str_hash = (int*)calloc((size_t)prog->str_hash_size, sizeof(int));
+        for (int id = 0; id < prog->num_strs; id++) str_hash_insert(prog, id);
     }
-    run_mode = 0;
-    run_index = -1;
+    return prog->num_strs - 1;
 }
 
-static void do_list(void) {
-    for (int i = 0; i < num_program_lines; i++) {
-        printf("%d %s\n", program[i].num, program[i].text);
-    }
+/* Re-index the string table after it was replaced wholesale */
+static void rebuild_string_hash(Program* prog) {
+    free(prog->str_hash);
+    prog->str_hash_size = 64;
+    while (prog->str_hash_size < prog->num_strs * 2 + 2) prog->str_hash_size *= 2;
+    prog->str_hash = (int*)calloc((size_t)prog->str_hash_size, sizeof(int));
+    for (int id = 0; id < prog->num_strs; id++) str_hash_insert(prog, id);
 }
 
-static void do_new(void) {
-    clear_program();
-    printf("Program cleared.\n");
+static void clear_strings(Program* prog) {
+    prog->str_len = 0;
+    prog->num_strs = 0;
+    if (prog->str_hash) memset(prog->str_hash, 0, (size_t)prog->str_hash_size * sizeof(int));
 }
 
-static int do_load(const char* filename) {
-    FILE* f = fopen(filename, "r");
-    if (!f) {
-        printf("Cannot open file: %s\n", filename);
-        return -1;
+static unsigned char* put_int(unsigned char* o, int v) {
+    unsigned int u = (unsigned int)v;
+    o[0] = (unsigned char)u; o[1] = (unsigned char)(u >> 8);
+    o[2] = (unsigned char)(u >> 16); o[3] = (unsigned char)(u >> 24);
+    return o + 4;
+}
+
+static int get_int(const unsigned char* p) {
+    return (int)((unsigned int)p[0] | (unsigned int)p[1] << 8 | (unsigned int)p[2] << 16 | (unsigned int)p[3] << 24);
+}
+
+/* Crunch statement text into out (at least 3 * strlen(text) + 1 bytes).
+   Keyword recognition follows execute_line_text() exactly. Returns length. */
+static int tokenize(Program* prog, const char* text, unsigned char* out) {
+    /* keyword, characters that may follow it, may it end the line */
+    static const struct { const char* kw; const char* seps; int at_end; int tok; } stmts[] = {
+        { "PRINT", " \t", 1, TOK_PRINT },
+        { "LET", " \t", 0, TOK_LET },
+        { "GOTO", " \t", 0, TOK_GOTO },
+        { "IF", " \t", 0, TOK_IF },
+        { "END", " \t\n", 1, TOK_END },
+        { "DIM", " \t", 0, TOK_DIM },
+        { "FOR", " \t", 0, TOK_FOR },
+        { "NEXT", " \t", 1, TOK_NEXT },
+        { "GOSUB", " \t", 0, TOK_GOSUB },
+        { "RETURN", " \t\n", 1, TOK_RETURN },
+        { "MAT", " \t", 0, TOK_MAT },
+        { "INPUT", " \t", 0, TOK_INPUT },
+        { "DATA", " \t", 0, TOK_DATA },
+        { "READ", " \t", 0, TOK_READ },
+        { "RESTORE", " \t\n", 1, TOK_RESTORE },
+        { "PARALLEL", " \t", 0, TOK_PARALLEL },
+    };
+    const char* p = text;
+    unsigned char* o = out;
+    int want = 0;       /* keyword expected later in the statement: THEN, TO, then STEP */
+    while (*p == ' ' || *p == '\t') *o++ = (unsigned char)*p++;
+    for (size_t k = 0; k < sizeof(stmts) / sizeof(stmts[0]); k++) {
+        size_t n = strlen(stmts[k].kw);
+        if (strncmp(p, stmts[k].kw, n) != 0) continue;
+        if (p[n] ? strchr(stmts[k].seps, p[n]) == NULL : !stmts[k].at_end) break;
+        *o++ = (unsigned char)stmts[k].tok;
+        p += n;
+        want = stmts[k].tok == TOK_IF ? TOK_THEN : stmts[k].tok == TOK_FOR ? TOK_TO : 0;
+        break;
+    }
+    if (o > out && o[-1] == TOK_PARALLEL) {
+        while (*p == ' ' || *p == '\t') *o++ = (unsigned char)*p++;
+        if (strncmp(p, "FOR", 3) == 0 && (p[3] == ' ' || p[3] == '\t')) {
+            *o++ = TOK_FOR;
+            p += 3;
+            want = TOK_TO;
+        }
     }
-    clear_program();
-    char buf[MAX_LINELEN];
-    int line_num;
-    while (fgets(buf, sizeof(buf), f)) {
-        if (sscanf(buf, "%d", &line_num) == 1) {
-            char* rest = buf;
-            while (*rest && (*rest == ' ' || isdigit((unsigned char)*rest))) rest++;
-            while (*rest == ' ' || *rest == '\t') rest++;
-            if (num_program_lines < MAX_LINES) {
-                program[num_program_lines].num = line_num;
-                strncpy(program[num_program_lines].text, rest, MAX_LINELEN - 1);
-                program[num_program_lines].text[MAX_LINELEN - 1] = '\0';
-                /* trim trailing newline */
-                size_t len = strlen(program[num_program_lines].text);
-                if (len > 0 && program[num_program_lines].text[len - 1] == '\n')
-                    program[num_program_lines].text[len - 1] = '\0';
-                num_program_lines++;
+    while (*p) {
+        size_t n = want ? strlen(keyword_names[want - TOK_PRINT]) : 0;
+        if (want && strncmp(p, keyword_names[want - TOK_PRINT], n) == 0) {
+            *o++ = (unsigned char)want;
+            p += n;
+            want = want == TOK_TO ? TOK_STEP : 0;
+        } else if (isdigit((unsigned char)*p)) {
+            const char* s = p;
+            long long v = 0;
+            while (isdigit((unsigned char)*p) && v <= 2147483647LL) v = v * 10 + (*p++ - '0');
+            if (isdigit((unsigned char)*p) || v > 2147483647LL || (*s == '0' && p - s > 1)) {
+                /* not canonical: keep the digits as written */
+                p = s;
+                while (isdigit((unsigned char)*p)) *o++ = (unsigned char)*p++;
+            } else if (v <= 255) {
+                *o++ = TOK_BYTE;
+                *o++ = (unsigned char)v;
+            } else {
+                *o++ = TOK_NUM;
+                o = put_int(o, (int)v);
             }
+        } else if (*p == '"') {
+            const char* s = ++p;
+            while (*p && *p != '"') p++;
+            *o++ = *p ? TOK_STR : TOK_OPENSTR;
+            o = put_int(o, intern_string(prog, s, (int)(p - s)));
+            if (*p) p++;
+        } else if ((unsigned char)*p >= 0x80) {
+            *o++ = TOK_RAW;
+            *o++ = (unsigned char)*p++;
+        } else {
+            *o++ = (unsigned char)*p++;
         }
     }
-    fclose(f);
-    sort_program();
-    printf("Loaded %s\n", filename);
-    return 0;
+    *o = 0;
+    return (int)(o - out);
 }
 
-static void do_save(const char* filename) {
-    FILE* f = fopen(filename, "w");
-    if (!f) {
-        printf("Cannot create file: %s\n", filename);
-        return;
-    }
-    for (int i = 0; i < num_program_lines; i++) {
-        fprintf(f, "%d %s\n", program[i].num, program[i].text);
+/* Write the source text of a tokenized line through write(user, ...) */
+static void detokenize(const Program* prog, BasicWriteFn write, void* user, const unsigned char* t) {
+    char num[12];
+    while (*t) {
+        const StrRef* r;
+        switch (*t) {
+        case TOK_BYTE: write(user, num, (size_t)sprintf(num, "%d", t[1])); t += 2; break;
+        case TOK_NUM: write(user, num, (size_t)sprintf(num, "%d", get_int(t + 1))); t += 5; break;
+        case TOK_STR:
+        case TOK_OPENSTR:
+            r = &prog->strs[get_int(t + 1)];
+            write(user, "\"", 1);
+            write(user, prog->str_pool + r->off, (size_t)r->len);
+            if (*t == TOK_STR) write(user, "\"", 1);
+            t += 5;
+            break;
+        case TOK_RAW: write(user, (const char*)t + 1, 1); t += 2; break;
+        default:
+            if (*t >= TOK_PRINT) write(user, keyword_names[*t - TOK_PRINT], strlen(keyword_names[*t - TOK_PRINT]));
+            else write(user, (const char*)t, 1);
+            t++;
+            break;
+        }
     }
-    fclose(f);
-    printf("Saved %s\n", filename);
 }
 
-/* Process direct statement (no line number) or add program line */
-static int process_input(char* buf) {
-    /* Trim newline */
-    size_t len = strlen(buf);
-    if (len > 0 && buf[len - 1] == '\n') { buf[len - 1] = '\0'; len--; }
+/* Replace the contents of ln with the tokenized form of text (len bytes,
+   NUL-terminated). Tokens are written straight into the line arena. */
+static void store_line(Program* prog, Line* ln, int num, const char* text, size_t len) {
+    size_t reserve = len * 3 + 1;
+    ln->num = num;
+    ln->code = NULL;
+    ln->unreachable = 0;
+    ln->data = NULL;
+    ln->data_len = 0;
+    ln->tok = (unsigned char*)arena_alloc(&prog->line_arena, reserve);
+    ln->len = tokenize(prog, text, ln->tok);
+    arena_trim(&prog->line_arena, ln->tok, reserve, (size_t)ln->len + 1);
+}
 
-    const char* p = buf;
-    while (*p == ' ' || *p == '\t') p++;
-    if (!*p) return 0;
+/* Make room for one more line at the end of program[] */
+static void grow_program(Program* prog) {
+    if (prog->num_lines < prog->lines_cap) return;
+    prog->lines_cap = prog->lines_cap ? prog->lines_cap * 2 : 64;
+    prog->lines = (Line*)realloc(prog->lines, (size_t)prog->lines_cap * sizeof(Line));
+}
 
-    /* Line number at start => program line */
-    if (isdigit((unsigned char)*p)) {
-        int line_num = 0;
-        while (isdigit((unsigned char)*p)) { line_num = line_num * 10 + (*p - '0'); p++; }
-        while (*p == ' ' || *p == '\t') p++;
-        if (*p) add_line(line_num, p);
-        else {
-            /* Delete line */
-            for (int i = 0; i < num_program_lines; i++) {
-                if (program[i].num == line_num) {
-                    for (int k = i; k < num_program_lines - 1; k++) program[k] = program[k + 1];
-                    num_program_lines--;
-                    break;
-                }
-            }
-        }
-        return 0;
-    }
+/*
+ * Bytecode compiler. At RUN every program line is compiled once into a
+ * run of opcodes with inline operands; lines are laid out back to back so
+ * falling off the end of one line continues with the next. Expressions use
+ * a small value stack.
+ */
+enum {
+    OP_PUSH,    /* n        push constant */
+    OP_LOAD,    /* v        push vars[v] */
+    OP_LOADA,   /* v        pop index, push arrays[v][index] or 0 */
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_NEG,
+    OP_SHL,     /* k        multiply top of stack by 2^k */
+    OP_EQ, OP_NE, OP_LT, OP_GT, OP_LE, OP_GE,   /* same order as CMP_* */
+    OP_STORE,   /* v        pop value into vars[v] */
+    OP_STOREA,  /* v        pop value, pop index, store if in range */
+    OP_DIM,     /* v        pop size, allocate arrays[v] */
+    OP_PRINTN,  /* pop and print number */
+    OP_PRINTS,  /* off len  print string pool bytes */
+    OP_PRINTC,  /* c        print one character */
+    OP_JMP,     /* pc       jump to resolved code offset */
+    OP_JNZ,     /* pc       pop condition, jump if nonzero */
+    OP_GOTO,    /* num      unresolved jump: look up line number, fall through if missing */
+    OP_IFGOTO,  /* num      pop condition, GOTO num if nonzero */
+    OP_END,
+    /* Superinstructions for loop idioms, emitted only when optimizing */
+    OP_INCV,    /* v k      vars[v] += k  (LET V = V + k) */
+    OP_LOADAV,  /* a v      push arrays[a][vars[v]] or 0 */
+    OP_STOREAV, /* a v      pop value into arrays[a][vars[v]] if in range */
+    OP_JEQVC, OP_JNEVC, OP_JLTVC, OP_JGTVC, OP_JLEVC, OP_JGEVC,  /* v k pc: jump if vars[v] cmp k */
+    OP_JEQVV, OP_JNEVV, OP_JLTVV, OP_JGTVV, OP_JLEVV, OP_JGEVV,  /* v w pc: jump if vars[v] cmp vars[w] */
+    OP_LINE,    /* i        start of line i, emitted only when profiling */
+    OP_FOR,     /* v        pop step, pop limit, start a loop on vars[v], see ctrl_for() */
+    OP_NEXT,    /* v        step the loop on vars[v] (-1: innermost), jump back if unfinished */
+    OP_GOSUB,   /* pc       push a return to the next op, jump */
+    OP_RETURN,  /* jump to the innermost GOSUB's return, if any */
+    OP_MAT,     /* d x op y pop scalar operands (y, then x) where x, y < 0, see mat_assign() */
+    OP_MATSUM,  /* v a      vars[v] = sum of arrays[a] */
+    OP_TRACE,   /* i        start of line i, emitted only when tracing */
+    OP_INPUT,   /* v        read a number of the input into vars[v], see input_number() */
+    OP_INPUTA,  /* a        pop index, read a number into arrays[a][index] if in range */
+    OP_READ,    /* v        next DATA value into vars[v] */
+    OP_READA,   /* a        pop index, next DATA value into arrays[a][index] if in range */
+    OP_RESTORE, /* num      READ from the first DATA at or after line num; linked: pool offset */
+    OP_PAR,     /* pc sums  before OP_FOR: run the loop on threads and go on at pc (-1: don't), see par_for() */
+    OP_PEND,    /* i        after the NEXT of the PARALLEL FOR on line i: a worker's chunk is done */
+    OP_COUNT
+};
 
-    /* Direct commands */
-    if (strncmp(p, "RUN", 3) == 0 && (p[3] == '\0' || p[3] == ' ' || p[3] == '\t')) {
-        do_run();
-        return 0;
+/* Words per instruction, opcode included, in OP_* order */
+static const unsigned char op_len[] = {
+    2, 2, 2,                /* PUSH LOAD LOADA */
+    1, 1, 1, 1, 1, 2,       /* ADD SUB MUL DIV NEG SHL */
+    1, 1, 1, 1, 1, 1,       /* EQ .. GE */
+    2, 2, 2,                /* STORE STOREA DIM */
+    1, 3, 2,                /* PRINTN PRINTS PRINTC */
+    2, 2, 2, 2, 1,          /* JMP JNZ GOTO IFGOTO END */
+    3, 3, 3,                /* INCV LOADAV STOREAV */
+    4, 4, 4, 4, 4, 4,       /* JxxVC */
+    4, 4, 4, 4, 4, 4,       /* JxxVV */
+    2,                      /* LINE */
+    2, 2, 2, 1,             /* FOR NEXT GOSUB RETURN */
+    5, 3,                   /* MAT MATSUM */
+    2,                      /* TRACE */
+    2, 2, 2, 2, 2,          /* INPUT INPUTA READ READA RESTORE */
+    3, 2                    /* PAR PEND */
+};
+
+static void emit(Interp* in, int word) {
+    if (in->code_buf_len == in->code_buf_cap) {
+        in->code_buf_cap = in->code_buf_cap ? in->code_buf_cap * 2 : 256;
+        in->code_buf = (int*)realloc(in->code_buf, (size_t)in->code_buf_cap * sizeof(int));
+    }
+    in->code_buf[in->code_buf_len++] = word;
+}
+
+/* Track value stack use so the VM can size its stack once per run */
+static void stack_push(Interp* in, int n) {
+    in->stack_depth += n;
+    if (in->stack_depth > in->stack_max) in->stack_max = in->stack_depth;
+}
+
+/* Jump to line number target, resolved when the program is linked */
+static void emit_jump(Interp* in, int op, int target) {
+    emit(in, op);
+    emit(in, target);
+}
+
+/* Fused compare-and-branch: op a b target */
+static void emit_branch(Interp* in, int op, int a, int b, int target) {
+    emit(in, op);
+    emit(in, a);
+    emit(in, b);
+    emit(in, target);
+}
+
+/* Integer literal at parse_ptr: a TOK_BYTE/TOK_NUM token or verbatim digits */
+static int compile_number(Interp* in, int* out) {
+    const unsigned char* t;
+    skip_spaces(in);
+    t = (const unsigned char*)in->parse_ptr;
+    if (*t == TOK_BYTE) { *out = t[1]; in->parse_ptr += 2; return 0; }
+    if (*t == TOK_NUM) { *out = get_int(t + 1); in->parse_ptr += 5; return 0; }
+    return parse_number(in, out);
+}
+
+/*
+ * Expressions are parsed into a tree (mirroring eval_expr()), optionally
+ * simplified by fold(), then emitted as stack code. Nodes live in a pool
+ * that is reset for every statement.
+ */
+enum { N_NUM, N_VAR, N_ARR, N_NEG, N_ADD, N_SUB, N_MUL, N_DIV, N_SHL };
+
+typedef struct Node {
+    int kind;
+    int val;        /* N_NUM value, N_VAR/N_ARR variable, N_SHL shift count */
+    int a, b;       /* operand nodes */
+} Node;
+
+static int new_node(Interp* in, int kind, int val, int a, int b) {
+    if (in->num_nodes == in->nodes_cap) {
+        in->nodes_cap = in->nodes_cap ? in->nodes_cap * 2 : 64;
+        in->nodes = (Node*)realloc(in->nodes, (size_t)in->nodes_cap * sizeof(Node));
+    }
+    in->nodes[in->num_nodes].kind = kind;
+    in->nodes[in->num_nodes].val = val;
+    in->nodes[in->num_nodes].a = a;
+    in->nodes[in->num_nodes].b = b;
+    return in->num_nodes++;
+}
+
+static int tree_expr(Interp* in);
+
+static int tree_primary(Interp* in) {
+    skip_spaces(in);
+    if (*in->parse_ptr == '(') {
+        in->parse_ptr++;
+        int n = tree_expr(in);
+        skip_spaces(in);
+        if (*in->parse_ptr == ')') in->parse_ptr++;
+        return n;
+    }
+    if (*in->parse_ptr == '-') {
+        in->parse_ptr++;
+        return new_node(in, N_NEG, 0, tree_primary(in), -1);
+    }
+    int n;
+    if (compile_number(in, &n) == 0) return new_node(in, N_NUM, n, -1, -1);
+    int vi = parse_var(in);
+    if (vi < 0) return new_node(in, N_NUM, 0, -1, -1);
+    skip_spaces(in);
+    if (*in->parse_ptr == '(') {
+        in->parse_ptr++;
+        int idx = tree_expr(in);
+        skip_spaces(in);
+        if (*in->parse_ptr == ')') in->parse_ptr++;
+        return new_node(in, N_ARR, vi, idx, -1);
+    }
+    return new_node(in, N_VAR, vi, -1, -1);
+}
+
+static int tree_term(Interp* in) {
+    int n = tree_primary(in);
+    skip_spaces(in);
+    for (;;) {
+        if (*in->parse_ptr == '*') {
+            in->parse_ptr++;
+            n = new_node(in, N_MUL, 0, n, tree_primary(in));
+        } else if (*in->parse_ptr == '/') {
+            in->parse_ptr++;
+            n = new_node(in, N_DIV, 0, n, tree_primary(in));
+        } else break;
+        skip_spaces(in);
+    }
+    return n;
+}
+
+static int tree_expr(Interp* in) {
+    int n = tree_term(in);
+    skip_spaces(in);
+    for (;;) {
+        if (*in->parse_ptr == '+') {
+            in->parse_ptr++;
+            n = new_node(in, N_ADD, 0, n, tree_term(in));
+        } else if (*in->parse_ptr == '-') {
+            in->parse_ptr++;
+            n = new_node(in, N_SUB, 0, n, tree_term(in));
+        } else break;
+        skip_spaces(in);
+    }
+    return n;
+}
+
+/* Folding uses wrapping arithmetic, which is what the VM's int ops do */
+static int wrap_add(int a, int b) { return (int)((unsigned int)a + (unsigned int)b); }
+static int wrap_mul(int a, int b) { return (int)((unsigned int)a * (unsigned int)b); }
+
+static int is_num(Interp* in, int n, int v) {
+    return in->nodes[n].kind == N_NUM && in->nodes[n].val == v;
+}
+
+static int log2_exact(int v) {
+    int k = 0;
+    if (v <= 1 || (v & (v - 1)) != 0) return -1;
+    while ((1 << k) != v) k++;
+    return k;
+}
+
+/*
+ * Simplify an expression tree: fold constant subexpressions, drop +0, -0,
+ * *1 and /1, turn multiplication by a power of two into a shift, and merge
+ * chained constant offsets such as X+2+3. Expressions have no side effects,
+ * so operands may be discarded (X*0 is 0). Division by zero folds to 0,
+ * as in eval_term(); INT_MIN / -1 is left for run time.
+ */
+static int fold(Interp* in, int n) {
+    int kind = in->nodes[n].kind;
+    int a, b, k;
+    if (kind == N_NUM || kind == N_VAR) return n;
+    if (kind == N_ARR) {
+        a = fold(in, in->nodes[n].a);   /* may grow in->nodes */
+        in->nodes[n].a = a;
+        return n;
+    }
+    a = fold(in, in->nodes[n].a);
+    if (kind == N_NEG) {
+        if (in->nodes[a].kind == N_NUM) return new_node(in, N_NUM, wrap_mul(in->nodes[a].val, -1), -1, -1);
+        if (in->nodes[a].kind == N_NEG) return in->nodes[a].a;
+        in->nodes[n].a = a;
+        return n;
+    }
+    b = fold(in, in->nodes[n].b);
+    if (in->nodes[a].kind == N_NUM && in->nodes[b].kind == N_NUM) {
+        int x = in->nodes[a].val, y = in->nodes[b].val;
+        switch (kind) {
+        case N_ADD: return new_node(in, N_NUM, wrap_add(x, y), -1, -1);
+        case N_SUB: return new_node(in, N_NUM, wrap_add(x, wrap_mul(y, -1)), -1, -1);
+        case N_MUL: return new_node(in, N_NUM, wrap_mul(x, y), -1, -1);
+        case N_DIV:
+            if (y == 0) return new_node(in, N_NUM, 0, -1, -1);
+            if (!(y == -1 && x == (int)0x80000000u)) return new_node(in, N_NUM, x / y, -1, -1);
+            break;
+        }
+    }
+    switch (kind) {
+    case N_ADD:
+    case N_SUB:
+        if (is_num(in, b, 0)) return a;
+        if (kind == N_ADD && is_num(in, a, 0)) return b;
+        if (kind == N_SUB && is_num(in, a, 0)) return fold(in, new_node(in, N_NEG, 0, b, -1));
+        if (in->nodes[b].kind == N_NUM && (in->nodes[a].kind == N_ADD || in->nodes[a].kind == N_SUB)
+            && in->nodes[in->nodes[a].b].kind == N_NUM) {
+            /* (X +- c1) +- c2  =>  X + c */
+            int c1 = in->nodes[in->nodes[a].b].val, c2 = in->nodes[b].val;
+            if (in->nodes[a].kind == N_SUB) c1 = wrap_mul(c1, -1);
+            if (kind == N_SUB) c2 = wrap_mul(c2, -1);
+            return fold(in, new_node(in, N_ADD, 0, in->nodes[a].a, new_node(in, N_NUM, wrap_add(c1, c2), -1, -1)));
+        }
+        break;
+    case N_MUL:
+        if (is_num(in, a, 0) || is_num(in, b, 0)) return new_node(in, N_NUM, 0, -1, -1);
+        if (is_num(in, b, 1)) return a;
+        if (is_num(in, a, 1)) return b;
+        if (is_num(in, b, -1)) return fold(in, new_node(in, N_NEG, 0, a, -1));
+        if (is_num(in, a, -1)) return fold(in, new_node(in, N_NEG, 0, b, -1));
+        if (in->nodes[b].kind == N_NUM && (k = log2_exact(in->nodes[b].val)) > 0) return new_node(in, N_SHL, k, a, -1);
+        if (in->nodes[a].kind == N_NUM && (k = log2_exact(in->nodes[a].val)) > 0) return new_node(in, N_SHL, k, b, -1);
+        break;
+    case N_DIV:
+        if (is_num(in, b, 0) || is_num(in, a, 0)) return new_node(in, N_NUM, 0, -1, -1);
+        if (is_num(in, b, 1)) return a;
+        if (is_num(in, b, -1)) return fold(in, new_node(in, N_NEG, 0, a, -1));
+        break;
+    }
+    in->nodes[n].a = a;
+    in->nodes[n].b = b;
+    return n;
+}
+
+static void emit_tree(Interp* in, int n) {
+    const Node* x = &in->nodes[n];
+    switch (x->kind) {
+    case N_NUM: emit(in, OP_PUSH); emit(in, x->val); stack_push(in, 1); break;
+    case N_VAR: emit(in, OP_LOAD); emit(in, x->val); stack_push(in, 1); break;
+    case N_ARR:
+        if (in->optimize && in->nodes[x->a].kind == N_VAR) {
+            emit(in, OP_LOADAV); emit(in, x->val); emit(in, in->nodes[x->a].val); stack_push(in, 1);
+            break;
+        }
+        emit_tree(in, x->a); emit(in, OP_LOADA); emit(in, in->nodes[n].val);
+        break;
+    case N_NEG: emit_tree(in, x->a); emit(in, OP_NEG); break;
+    case N_SHL: emit_tree(in, x->a); emit(in, OP_SHL); emit(in, in->nodes[n].val); break;
+    default:
+        emit_tree(in, x->a);
+        emit_tree(in, in->nodes[n].b);
+        emit(in, in->nodes[n].kind == N_ADD ? OP_ADD : in->nodes[n].kind == N_SUB ? OP_SUB :
+             in->nodes[n].kind == N_MUL ? OP_MUL : OP_DIV);
+        stack_push(in, -1);
+        break;
+    }
+}
+
+/* Parse the expression at parse_ptr into a tree, simplified when optimizing */
+static int expr_tree(Interp* in) {
+    int n = tree_expr(in);
+    return in->optimize ? fold(in, n) : n;
+}
+
+static void compile_expr(Interp* in) {
+    emit_tree(in, expr_tree(in));
+}
+
+/* A single operand: number, variable, array element or parenthesized expression */
+static void compile_primary(Interp* in) {
+    int n = tree_primary(in);
+    emit_tree(in, in->optimize ? fold(in, n) : n);
+}
+
+/* Compile one tokenized statement; same grammar and quirks as execute_line_text() */
+static void compile_line(Interp* in, const unsigned char* tok) {
+    Program* prog = in->prog;
+    in->parse_ptr = (const char*)tok;
+    skip_spaces(in);
+    in->stack_depth = 0;
+    in->num_nodes = 0;
+    int kw = (unsigned char)*in->parse_ptr, par = 0;
+    if (kw >= TOK_PRINT) in->parse_ptr++;
+    if (kw == TOK_PARALLEL) {
+        skip_spaces(in);
+        par = 1;
+        kw = (unsigned char)*in->parse_ptr;
+        if (kw != TOK_FOR) return;
+        in->parse_ptr++;
+    }
+
+    if (kw == TOK_PRINT) {
+        for (;;) {
+            skip_spaces(in);
+            if (!*in->parse_ptr) break;
+            if ((unsigned char)*in->parse_ptr == TOK_STR || (unsigned char)*in->parse_ptr == TOK_OPENSTR) {
+                const StrRef* r = &prog->strs[get_int((const unsigned char*)in->parse_ptr + 1)];
+                in->parse_ptr += 5;
+                if (r->len) {
+                    emit(in, OP_PRINTS); emit(in, r->off); emit(in, r->len);
+                }
+            } else {
+                compile_expr(in);
+                emit(in, OP_PRINTN); stack_push(in, -1);
+            }
+            skip_spaces(in);
+            if (*in->parse_ptr == ',') { in->parse_ptr++; emit(in, OP_PRINTC); emit(in, ' '); continue; }
+            break;
+        }
+        emit(in, OP_PRINTC); emit(in, '\n');
+        return;
+    }
+
+    if (kw == TOK_LET) {
+        skip_spaces(in);
+        int vi = parse_var(in);
+        if (vi < 0) return;
+        skip_spaces(in);
+        if (*in->parse_ptr == '(') {
+            in->parse_ptr++;
+            int idx = expr_tree(in);
+            skip_spaces(in);
+            if (*in->parse_ptr == ')') in->parse_ptr++;
+            skip_spaces(in);
+            if (*in->parse_ptr == '=') in->parse_ptr++;
+            int value = expr_tree(in);
+            if (in->optimize && in->nodes[idx].kind == N_VAR) {
+                emit_tree(in, value);
+                emit(in, OP_STOREAV); emit(in, vi); emit(in, in->nodes[idx].val); stack_push(in, -1);
+                return;
+            }
+            emit_tree(in, idx);
+            emit_tree(in, value);
+            emit(in, OP_STOREA); emit(in, vi); stack_push(in, -2);
+        } else {
+            skip_spaces(in);
+            if (*in->parse_ptr == '=') in->parse_ptr++;
+            int value = expr_tree(in);
+            const Node* x = &in->nodes[value];
+            if (in->optimize && (x->kind == N_ADD || x->kind == N_SUB) && in->nodes[x->a].kind == N_VAR
+                && in->nodes[x->a].val == vi && in->nodes[x->b].kind == N_NUM) {
+                emit(in, OP_INCV); emit(in, vi);
+                emit(in, x->kind == N_ADD ? in->nodes[x->b].val : wrap_mul(in->nodes[x->b].val, -1));
+                return;
+            }
+            if (in->optimize && x->kind == N_ADD && in->nodes[x->b].kind == N_VAR
+                && in->nodes[x->b].val == vi && in->nodes[x->a].kind == N_NUM) {
+                emit(in, OP_INCV); emit(in, vi); emit(in, in->nodes[x->a].val);
+                return;
+            }
+            emit_tree(in, value);
+            emit(in, OP_STORE); emit(in, vi); stack_push(in, -1);
+        }
+        return;
+    }
+
+    if (kw == TOK_GOTO) {
+        int target;
+        if (compile_number(in, &target) == 0) emit_jump(in, OP_GOTO, target);
+        return;
+    }
+
+    if (kw == TOK_IF) {
+        /* A condition without a comparison, or a THEN without a line number,
+           never jumps; such an IF compiles to nothing. So does a constant
+           false condition, and a constant true one becomes a GOTO. */
+        int cmp, target, left, right;
+        left = expr_tree(in);
+        if (parse_compare(in, &cmp) != 0) return;
+        right = expr_tree(in);
+        skip_spaces(in);
+        if ((unsigned char)*in->parse_ptr == TOK_THEN) in->parse_ptr++;
+        if (compile_number(in, &target) != 0) return;
+        if (in->optimize && in->nodes[left].kind == N_NUM && in->nodes[right].kind == N_NUM) {
+            int x = in->nodes[left].val, y = in->nodes[right].val;
+            static const int taken[6][3] = {   /* x<y, x==y, x>y for each CMP_* */
+                { 0, 1, 0 }, { 1, 0, 1 }, { 1, 0, 0 }, { 0, 0, 1 }, { 1, 1, 0 }, { 0, 1, 1 }
+            };
+            if (taken[cmp][x < y ? 0 : x == y ? 1 : 2]) emit_jump(in, OP_GOTO, target);
+            return;
+        }
+        if (in->optimize && in->nodes[left].kind == N_NUM && in->nodes[right].kind == N_VAR) {
+            /* k < V is V > k: swap operands and mirror the comparison */
+            static const int mirror[6] = { CMP_EQ, CMP_NE, CMP_GT, CMP_LT, CMP_GE, CMP_LE };
+            int t = left;
+            left = right;
+            right = t;
+            cmp = mirror[cmp];
+        }
+        if (in->optimize && in->nodes[left].kind == N_VAR && in->nodes[right].kind == N_NUM) {
+            emit_branch(in, OP_JEQVC + cmp, in->nodes[left].val, in->nodes[right].val, target);
+            return;
+        }
+        if (in->optimize && in->nodes[left].kind == N_VAR && in->nodes[right].kind == N_VAR) {
+            emit_branch(in, OP_JEQVV + cmp, in->nodes[left].val, in->nodes[right].val, target);
+            return;
+        }
+        emit_tree(in, left);
+        emit_tree(in, right);
+        emit(in, OP_EQ + cmp); stack_push(in, -1);
+        emit_jump(in, OP_IFGOTO, target); stack_push(in, -1);
+        return;
+    }
+
+    if (kw == TOK_FOR) {
+        skip_spaces(in);
+        int vi = parse_var(in);
+        if (vi < 0) return;
+        skip_spaces(in);
+        if (*in->parse_ptr == '=') in->parse_ptr++;
+        compile_expr(in);
+        emit(in, OP_STORE); emit(in, vi); stack_push(in, -1);
+        skip_spaces(in);
+        if ((unsigned char)*in->parse_ptr == TOK_TO) in->parse_ptr++;
+        compile_expr(in);
+        skip_spaces(in);
+        if ((unsigned char)*in->parse_ptr == TOK_STEP) {
+            in->parse_ptr++;
+            compile_expr(in);
+        } else {
+            emit(in, OP_PUSH); emit(in, 1); stack_push(in, 1);
+        }
+        if (par) { emit(in, OP_PAR); emit(in, -1); emit(in, 0); }
+        emit(in, OP_FOR); emit(in, vi); stack_push(in, -2);
+        return;
+    }
+
+    if (kw == TOK_NEXT) {
+        emit(in, OP_NEXT); emit(in, parse_var(in));
+        return;
+    }
+
+    if (kw == TOK_GOSUB) {
+        int target;
+        if (compile_number(in, &target) == 0) emit_jump(in, OP_GOSUB, target);
+        return;
+    }
+
+    if (kw == TOK_RETURN) {
+        emit(in, OP_RETURN);
+        return;
+    }
+
+    if (kw == TOK_END) {
+        emit(in, OP_END);
+        return;
+    }
+
+    if (kw == TOK_DIM) {
+        skip_spaces(in);
+        int vi = parse_var(in);
+        if (vi >= 0) {
+            skip_spaces(in);
+            if (*in->parse_ptr == '(') {
+                in->parse_ptr++;
+                compile_expr(in);
+                skip_spaces(in);
+                if (*in->parse_ptr == ')') in->parse_ptr++;
+                emit(in, OP_DIM); emit(in, vi); stack_push(in, -1);
+            }
+        }
+        return;
+    }
+
+    if (kw == TOK_MAT) {
+        skip_spaces(in);
+        int form = mat_form(in);
+        int d = parse_var(in);
+        if (d < 0) return;
+        skip_spaces(in);
+        if (*in->parse_ptr == '=') in->parse_ptr++;
+        skip_spaces(in);
+        if (form == 'F') {
+            compile_expr(in);
+            emit(in, OP_MAT); emit(in, d); emit(in, -1); emit(in, MAT_COPY); emit(in, -1); stack_push(in, -1);
+        } else if (form == 'S') {
+            int a = parse_var(in);
+            if (a >= 0) { emit(in, OP_MATSUM); emit(in, d); emit(in, a); }
+        } else {
+            /* scalar operands are pushed, x first */
+            int x, y = -1, op, pushed = 0;
+            if ((x = parse_var(in)) < 0) { compile_primary(in); pushed++; }
+            op = mat_op(in);
+            if (op != MAT_COPY) {
+                skip_spaces(in);
+                if ((y = parse_var(in)) < 0) { compile_primary(in); pushed++; }
+            }
+            emit(in, OP_MAT); emit(in, d); emit(in, x); emit(in, op); emit(in, y); stack_push(in, -pushed);
+        }
+        return;
+    }
+
+    if (kw == TOK_INPUT || kw == TOK_READ) {
+        for (;;) {
+            int vi = parse_var(in);
+            if (vi < 0) break;
+            skip_spaces(in);
+            if (*in->parse_ptr == '(') {
+                in->parse_ptr++;
+                compile_expr(in);
+                skip_spaces(in);
+                if (*in->parse_ptr == ')') in->parse_ptr++;
+                emit(in, kw == TOK_INPUT ? OP_INPUTA : OP_READA); emit(in, vi); stack_push(in, -1);
+            } else {
+                emit(in, kw == TOK_INPUT ? OP_INPUT : OP_READ); emit(in, vi);
+            }
+            skip_spaces(in);
+            if (*in->parse_ptr != ',') break;
+            in->parse_ptr++;
+        }
+        return;
+    }
+
+    if (kw == TOK_RESTORE) {
+        int target;
+        emit(in, OP_RESTORE); emit(in, compile_number(in, &target) == 0 ? target : INT_MIN);
+        return;
+    }
+
+    /* DATA compiles to nothing; its values are parsed by parse_data() */
+}
+
+/* The values of a DATA line: integers with an optional minus sign,
+   separated by commas, up to anything else. Returns how many. */
+static int parse_data(Interp* in, Line* ln) {
+    size_t reserve = (size_t)ln->len / 2 + 1;
+    int n = 0;
+    ln->data = NULL;
+    in->parse_ptr = (const char*)ln->tok;
+    skip_spaces(in);
+    if ((unsigned char)*in->parse_ptr != TOK_DATA) return 0;
+    in->parse_ptr++;
+    ln->data = (int*)arena_alloc(&in->prog->line_arena, reserve * sizeof(int));
+    for (;;) {
+        int neg, v;
+        skip_spaces(in);
+        neg = *in->parse_ptr == '-';
+        if (neg) in->parse_ptr++;
+        if (compile_number(in, &v) != 0) break;
+        ln->data[n++] = neg ? wrap_mul(v, -1) : v;
+        skip_spaces(in);
+        if (*in->parse_ptr != ',') break;
+        in->parse_ptr++;
+    }
+    arena_trim(&in->prog->line_arena, ln->data, reserve * sizeof(int), (size_t)n * sizeof(int));
+    return n;
+}
+
+/* Code offset of line number num, or -1 if there is no such line */
+static int find_line_pc(const Program* prog, int num) {
+    int i = find_line(prog->lines, prog->num_lines, num);
+    return i >= 0 ? prog->line_pc[i] : -1;
+}
+
+/* pc_line[pc] = index of the line whose code holds offset pc */
+static void map_code_lines(Program* prog) {
+    int line = 0;
+    prog->pc_line = (int*)arena_alloc(&prog->code_arena, (size_t)prog->code_len * sizeof(int));
+    for (int pc = 0; pc < prog->code_len; pc++) {
+        while (line + 1 < prog->num_lines && prog->line_pc[line + 1] <= pc) line++;
+        prog->pc_line[pc] = line;
+    }
+}
+
+/* Drop every line's compiled statement, e.g. when the optimizer setting changes */
+static void forget_line_code(Program* prog) {
+    for (int i = 0; i < prog->num_lines; i++) prog->lines[i].code = NULL;
+    prog->code_valid = 0;
+}
+
+/*
+ * Control flow passes, run when optimizing. Every line is one statement,
+ * so lines are the basic blocks: control enters a line at its start and
+ * leaves at its end, by falling through to the next line or by a jump.
+ */
+
+/* Where a jump to line i really leads: past lines that are only a GOTO
+   and past empty lines, giving up on cycles after num_lines hops */
+static int thread_line(const Program* prog, int i) {
+    for (int hops = 0; hops < prog->num_lines; hops++) {
+        const Line* ln = &prog->lines[i];
+        int j;
+        if (ln->code_len == 0 && i + 1 < prog->num_lines) { i++; continue; }
+        if (ln->code_len != 2 || ln->code[0] != OP_GOTO) break;
+        j = find_line(prog->lines, prog->num_lines, ln->code[1]);
+        if (j < 0 || j == i) break;
+        i = j;
+    }
+    return i;
+}
+
+/* Line index the unlinked jump at ip leads to, threaded; -1 if ip is
+   not a jump or names a missing line */
+static int jump_line(const Program* prog, const int* ip) {
+    int op = ip[0], num, j;
+    if (op == OP_GOTO || op == OP_IFGOTO || op == OP_GOSUB) num = ip[1];
+    else if (op >= OP_JEQVC && op <= OP_JGEVV) num = ip[3];
+    else return -1;
+    j = find_line(prog->lines, prog->num_lines, num);
+    return j < 0 ? -1 : thread_line(prog, j);
+}
+
+/* Mark the lines that no path from the first line reaches, with jumps
+   threaded. A line falls through unless it ends in END or a GOTO to an
+   existing line; RETURN and NEXT fall through when there is no frame or
+   the loop is done. */
+static void find_reachable(Program* prog) {
+    int* work = (int*)malloc((size_t)(prog->num_lines + 1) * sizeof(int));
+    int n = 0;
+    for (int i = 0; i < prog->num_lines; i++) prog->lines[i].unreachable = 1;
+    if (prog->num_lines) { prog->lines[0].unreachable = 0; work[n++] = 0; }
+    while (n) {
+        int i = work[--n], falls = 1;
+        const Line* ln = &prog->lines[i];
+        for (int at = 0; at < ln->code_len; at += op_len[ln->code[at]]) {
+            int op = ln->code[at], j = jump_line(prog, ln->code + at);
+            if (op == OP_END || (op == OP_GOTO && j >= 0)) falls = 0;
+            if (j >= 0 && prog->lines[j].unreachable) { prog->lines[j].unreachable = 0; work[n++] = j; }
+        }
+        if (falls && i + 1 < prog->num_lines && prog->lines[i + 1].unreachable) {
+            prog->lines[i + 1].unreachable = 0;
+            work[n++] = i + 1;
+        }
+    }
+    free(work);
+}
+
+/* Offset of the first op in a line's code, or -1 */
+static int line_op(const Line* ln, int op) {
+    for (int at = 0; at < ln->code_len; at += op_len[ln->code[at]])
+        if (ln->code[at] == op) return at;
+    return -1;
+}
+
+/* Add what the op at ip writes to *vars and *arrays; a NEXT without a
+   variable may step any of for_vars */
+static void op_writes(const int* ip, unsigned int for_vars, unsigned int* vars, unsigned int* arrays) {
+    switch (ip[0]) {
+    case OP_STORE: case OP_INCV: case OP_FOR: case OP_MATSUM: case OP_INPUT: case OP_READ: *vars |= 1u << ip[1]; break;
+    case OP_NEXT: *vars |= ip[1] >= 0 ? 1u << ip[1] : for_vars; break;
+    case OP_STOREA: case OP_STOREAV: case OP_DIM: case OP_MAT: case OP_INPUTA: case OP_READA: *arrays |= 1u << ip[1]; break;
+    }
+}
+
+/* Line of the NEXT that closes the FOR heading line f, matching nested
+   FOR/NEXT pairs in the text, or -1 */
+static int match_next(const Program* prog, int f) {
+    int var = prog->lines[f].code[line_op(&prog->lines[f], OP_FOR) + 1], depth = 0;
+    for (int i = f + 1; i < prog->num_lines; i++) {
+        const Line* ln = &prog->lines[i];
+        int k, v;
+        if (ln->unreachable) continue;
+        if (line_op(ln, OP_FOR) >= 0) { depth++; continue; }
+        if ((k = line_op(ln, OP_NEXT)) < 0) continue;
+        v = ln->code[k + 1];
+        if (v == var || (v < 0 && depth == 0)) return i;
+        if (depth > 0) depth--;
+    }
+    return -1;
+}
+
+/* Are L's FOR loops properly nested, so that each frame pushed in L ends
+   before control leaves it and a NEXT in L steps a FOR of L known from
+   the text? True if every FOR has its own variable and its NEXT in L,
+   every NEXT closes one of them, and no jump leaves L or crosses into or
+   out of a FOR body. closes[i - head] gets the FOR line each NEXT closes. */
+static int loop_closed(const Program* prog, const Loop* L, int* closes) {
+    int n = L->last - L->head + 1, closed = 1;
+    int* next = (int*)malloc((size_t)n * sizeof(int));
+    unsigned int vars = 0;
+    for (int i = 0; i < n; i++) next[i] = closes[i] = -1;
+    for (int i = L->head; i <= L->last; i++) {
+        const Line* ln = &prog->lines[i];
+        int k = ln->unreachable ? -1 : line_op(ln, OP_FOR), y;
+        if (k < 0) continue;
+        y = match_next(prog, i);
+        if (y < 0 || y > L->last || (vars >> ln->code[k + 1] & 1)) { closed = 0; break; }
+        vars |= 1u << ln->code[k + 1];
+        next[i - L->head] = y;
+        closes[y - L->head] = i;
+    }
+    for (int i = L->head; i <= L->last && closed; i++) {
+        const Line* ln = &prog->lines[i];
+        if (ln->unreachable) continue;
+        if (line_op(ln, OP_NEXT) >= 0 && closes[i - L->head] < 0) closed = 0;
+        for (int at = 0; at < ln->code_len && closed; at += op_len[ln->code[at]]) {
+            int t = jump_line(prog, ln->code + at);
+            if (t < 0) continue;
+            if (t < L->head || t > L->last) closed = 0;
+            for (int x = L->head; x <= L->last && closed; x++) {
+                int y = next[x - L->head];
+                if (y < 0) continue;
+                if (x < i && i < y ? t < x || t > y : x < t && t <= y) closed = 0;
+            }
+        }
+    }
+    free(next);
+    return closed;
+}
+
+/* Can values be hoisted out of L, given the loops taken so far? Fills in
+   what L writes. */
+static int loop_ok(const Program* prog, Loop* L, const Loop* taken, int num_taken, unsigned int for_vars) {
+    int* closes;
+    int closed, ok = 1;
+    unsigned int fors = 0;
+    for (int k = 0; k < num_taken; k++) {
+        const Loop* o = &taken[k];
+        if (o->last < L->head || o->head > L->last) continue;
+        if (o->head < L->head || o->last > L->last) return 0;   /* overlapping, not nested */
+    }
+    closes = (int*)malloc((size_t)(L->last - L->head + 1) * sizeof(int));
+    closed = loop_closed(prog, L, closes);
+    L->vars = L->arrays = 0;
+    for (int i = L->head; i <= L->last && ok; i++) {
+        const Line* ln = &prog->lines[i];
+        if (ln->unreachable) continue;
+        for (int at = 0; at < ln->code_len; at += op_len[ln->code[at]]) {
+            const int* ip = ln->code + at;
+            if (ip[0] == OP_GOSUB) ok = 0;
+            if (ip[0] == OP_FOR) fors |= 1u << ip[1];
+            if (ip[0] == OP_NEXT && ip[1] < 0 && closed) {
+                const Line* f = &prog->lines[closes[i - L->head]];
+                L->vars |= 1u << f->code[line_op(f, OP_FOR) + 1];
+            } else {
+                op_writes(ip, for_vars, &L->vars, &L->arrays);
+            }
+        }
+    }
+    free(closes);
+    if (closed) fors = 0;
+    for (int i = 0; i < prog->num_lines && ok; i++) {
+        const Line* ln = &prog->lines[i];
+        if (ln->unreachable || (i >= L->head && i <= L->last)) continue;
+        for (int at = 0; at < ln->code_len; at += op_len[ln->code[at]]) {
+            const int* ip = ln->code + at;
+            int t = jump_line(prog, ip);
+            if (t > L->head && t <= L->last) ok = 0;
+            if (ip[0] == OP_NEXT && (ip[1] < 0 ? fors != 0 : (fors >> ip[1] & 1))) ok = 0;
+        }
+    }
+    return ok;
+}
+
+static int compare_loop_size(const void* a, const void* b) {
+    const Loop* x = (const Loop*)a;
+    const Loop* y = (const Loop*)b;
+    if (x->last - x->head != y->last - y->head) return x->last - x->head < y->last - y->head ? -1 : 1;
+    return x->head - y->head;
+}
+
+/*
+ * Loops for invariant hoisting. A line jumped back to from later lines
+ * heads a loop up to the last of them; a FOR line heads one up to its
+ * NEXT, the values coming from its body. A loop is used if nothing but its
+ * head is entered from outside, it has no GOSUB, and no NEXT outside can
+ * resume a FOR inside, which needs a FOR frame left behind on the way
+ * out. Its preheader then runs on every entry and its own jumps back to
+ * the head go past it. Loops kept are nested or disjoint; of two that
+ * overlap otherwise, the inner one wins.
+ */
+static void find_loops(Program* prog) {
+    int n = prog->num_lines, num = 0;
+    Loop* cand = (Loop*)malloc((size_t)(n + 1) * sizeof(Loop));
+    int* head = (int*)malloc((size_t)(n + 1) * sizeof(int));
+    unsigned int for_vars = 0;
+    for (int i = 0; i < n; i++) head[i] = -1;
+    for (int i = 0; i < n; i++) {
+        const Line* ln = &prog->lines[i];
+        if (ln->unreachable) continue;
+        for (int at = 0; at < ln->code_len; at += op_len[ln->code[at]]) {
+            const int* ip = ln->code + at;
+            int h, first, last = i;
+            if (ip[0] == OP_FOR) {
+                for_vars |= 1u << ip[1];
+                if ((last = match_next(prog, i)) < 0) continue;
+                h = i;
+                first = i + 1;
+            } else {
+                h = jump_line(prog, ip);
+                if (h < 0 || h > i || line_op(&prog->lines[h], OP_FOR) >= 0) continue;
+                first = h;
+            }
+            if (head[h] < 0) {
+                head[h] = num;
+                cand[num].head = h;
+                cand[num].first = first;
+                cand[num].last = last;
+                num++;
+            } else if (cand[head[h]].last < last) {
+                cand[head[h]].last = last;
+            }
+        }
+    }
+    qsort(cand, (size_t)num, sizeof(Loop), compare_loop_size);
+    prog->loops = (Loop*)arena_alloc(&prog->code_arena, (size_t)(num + 1) * sizeof(Loop));
+    prog->line_loop = (int*)arena_alloc(&prog->code_arena, (size_t)(n + 1) * sizeof(int));
+    for (int i = 0; i < n; i++) prog->line_loop[i] = -1;
+    prog->num_loops = 0;
+    for (int k = 0; k < num; k++) {
+        if (!loop_ok(prog, &cand[k], prog->loops, prog->num_loops, for_vars)) continue;
+        prog->line_loop[cand[k].head] = prog->num_loops;
+        prog->loops[prog->num_loops++] = cand[k];
+    }
+    free(cand);
+    free(head);
+}
+
+/* Does the STORE s at offset at of ln store s plus or minus a value that
+   does not involve s, as in LET S = S + X(I)? Replays the value stack,
+   each entry 0 without s, 1 for s itself, 2 for anything else using s. */
+static int store_adds(const Line* ln, int at, int s) {
+    char* st = (char*)malloc((size_t)ln->stack_max + 1);
+    int sp = 0, adds = 0;
+    for (int k = 0; k < at; k += op_len[ln->code[k]]) {
+        const int* ip = ln->code + k;
+        switch (ip[0]) {
+        case OP_PUSH: st[sp++] = 0; break;
+        case OP_LOAD: st[sp++] = ip[1] == s; break;
+        case OP_LOADAV: st[sp++] = ip[2] == s ? 2 : 0; break;
+        case OP_LOADA: case OP_NEG: case OP_SHL: if (st[sp - 1]) st[sp - 1] = 2; break;
+        default:
+            sp--;
+            if (k + 1 == at && ip[0] == OP_ADD) adds = st[sp - 1] + st[sp] == 1;
+            if (k + 1 == at && ip[0] == OP_SUB) adds = st[sp - 1] == 1 && st[sp] == 0;
+            st[sp - 1] = st[sp - 1] || st[sp] ? 2 : 0;
+            break;
+        }
+    }
+    free(st);
+    return adds;
+}
+
+/* Can the iterations of the PARALLEL FOR heading line f, closed on line m,
+   run on separate threads, see par_for()? Fills in the variables the body
+   only adds to and never otherwise reads. */
+static int par_loop_ok(const Program* prog, int f, int m, unsigned int* sums) {
+    Loop L;
+    int* closes = (int*)malloc((size_t)(m - f + 1) * sizeof(int));
+    int var = prog->lines[f].code[line_op(&prog->lines[f], OP_FOR) + 1], ok;
+    int loads[NUM_VARS] = { 0 };     /* reads of each scalar, less the S of each S = S + x */
+    unsigned int adds = 0, other = 0, reads = 0;
+    L.head = f;
+    L.first = f + 1;
+    L.last = m;
+    ok = loop_closed(prog, &L, closes);
+    free(closes);
+    for (int i = f + 1; i <= m && ok; i++) {
+        const Line* ln = &prog->lines[i];
+        if (ln->unreachable) continue;
+        for (int at = 0; at < ln->code_len && ok; at += op_len[ln->code[at]]) {
+            const int* ip = ln->code + at;
+            switch (ip[0]) {
+            case OP_DIM: case OP_PRINTN: case OP_PRINTS: case OP_PRINTC: case OP_END:
+            case OP_LINE: case OP_GOSUB: case OP_RETURN: case OP_MAT: case OP_TRACE:
+            case OP_INPUT: case OP_INPUTA: case OP_READ: case OP_READA: case OP_RESTORE:
+                ok = 0;
+                break;
+            case OP_LOAD: loads[ip[1]]++; break;
+            case OP_LOADAV: loads[ip[2]]++; break;
+            case OP_INCV: adds |= 1u << ip[1]; break;
+            case OP_STORE:
+                if (store_adds(ln, at, ip[1])) {
+                    adds |= 1u << ip[1];
+                    loads[ip[1]]--;
+                    break;
+                }
+                /* fall through */
+            case OP_FOR: case OP_MATSUM: other |= 1u << ip[1]; break;
+            default:
+                if (ip[0] >= OP_JEQVC && ip[0] <= OP_JGEVV) {
+                    loads[ip[1]]++;
+                    if (ip[0] >= OP_JEQVV) loads[ip[2]]++;
+                }
+                break;
+            }
+            if (jump_line(prog, ip) == f) ok = 0;
+        }
+    }
+    for (int v = 0; v < NUM_VARS; v++)
+        if (loads[v] > 0) reads |= 1u << v;
+    *sums = adds & ~other;
+    return ok && !(reads & *sums) && !((adds | other) >> var & 1);
+}
+
+/* A value computed once in a loop's preheader: code[s, e) of a line, kept
+   in vars[NUM_VARS + temp] */
+typedef struct {
+    int loop, line, s, e, temp;
+    int fresh;                  /* first use of temp: the preheader computes it */
+} Hoist;
+
+/* Subexpression on the value stack while a line is scanned for hoisting */
+typedef struct {
+    int s, e;                   /* its code */
+    int inv;                    /* loop-invariant */
+    int worth;                  /* more than one PUSH or LOAD */
+} StackExpr;
+
+/* Hoist x out of loop `loop` if it is invariant and worth it, sharing the
+   temp of an identical value already hoisted; returns the hoist count */
+static int hoist_expr(const Program* prog, Hoist* h, int nh, int* temps, int loop, int line, const StackExpr* x) {
+    const int* code = prog->lines[line].code;
+    int temp = -1, fresh = 0;
+    if (!x->inv || !x->worth) return nh;
+    for (int k = 0; k < nh && temp < 0; k++) {
+        if (h[k].loop == loop && h[k].fresh && h[k].e - h[k].s == x->e - x->s
+            && memcmp(prog->lines[h[k].line].code + h[k].s, code + x->s, (size_t)(x->e - x->s) * sizeof(int)) == 0)
+            temp = h[k].temp;
+    }
+    if (temp < 0) {
+        if (*temps == NUM_TEMPS) return nh;
+        temp = (*temps)++;
+        fresh = 1;
+    }
+    h[nh].loop = loop;
+    h[nh].line = line;
+    h[nh].s = x->s;
+    h[nh].e = x->e;
+    h[nh].temp = temp;
+    h[nh].fresh = fresh;
+    return nh + 1;
+}
+
+/* Find a line's largest invariant subexpressions by replaying its value
+   stack. Division is only hoisted by a constant other than -1, so a
+   hoisted value can never trap where the loop would not have run it. */
+static int hoist_line(const Program* prog, Hoist* h, int nh, int* temps, int loop, int line, StackExpr* st) {
+    const Loop* L = &prog->loops[loop];
+    const Line* ln = &prog->lines[line];
+    int sp = 0;
+    for (int at = 0; at < ln->code_len; at += op_len[ln->code[at]]) {
+        const int* ip = ln->code + at;
+        int op = ip[0], pops = 0;
+        StackExpr x;
+        x.s = at;
+        x.e = at + op_len[op];
+        x.inv = 0;
+        x.worth = 1;
+        switch (op) {
+        case OP_PUSH: x.inv = 1; x.worth = 0; st[sp++] = x; continue;
+        case OP_LOAD: x.inv = !(L->vars >> ip[1] & 1); x.worth = 0; st[sp++] = x; continue;
+        case OP_LOADAV: x.inv = !(L->arrays >> ip[1] & 1) && !(L->vars >> ip[2] & 1); st[sp++] = x; continue;
+        case OP_LOADA: case OP_NEG: case OP_SHL:
+            if (sp < 1) return nh;
+            x.s = st[sp - 1].s;
+            x.inv = st[sp - 1].inv && (op != OP_LOADA || !(L->arrays >> ip[1] & 1));
+            if (!x.inv) nh = hoist_expr(prog, h, nh, temps, loop, line, &st[sp - 1]);
+            st[sp - 1] = x;
+            continue;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_EQ: case OP_NE: case OP_LT: case OP_GT: case OP_LE: case OP_GE:
+            if (sp < 2) return nh;
+            x.s = st[sp - 2].s;
+            x.inv = st[sp - 2].inv && st[sp - 1].inv;
+            if (op == OP_DIV && (st[sp - 1].worth || ln->code[st[sp - 1].s] != OP_PUSH || ln->code[st[sp - 1].s + 1] == -1))
+                x.inv = 0;
+            if (!x.inv) {
+                nh = hoist_expr(prog, h, nh, temps, loop, line, &st[sp - 2]);
+                nh = hoist_expr(prog, h, nh, temps, loop, line, &st[sp - 1]);
+            }
+            st[--sp - 1] = x;
+            continue;
+        case OP_STORE: case OP_STOREAV: case OP_DIM: case OP_PRINTN: case OP_IFGOTO:
+        case OP_INPUTA: case OP_READA: pops = 1; break;
+        case OP_STOREA: case OP_FOR: pops = 2; break;
+        case OP_MAT: pops = (ip[4] < 0 && ip[3] != MAT_COPY) + (ip[2] < 0); break;
+        }
+        if (pops > sp) return nh;
+        while (pops-- > 0) nh = hoist_expr(prog, h, nh, temps, loop, line, &st[--sp]);
+    }
+    return nh;
+}
+
+static int compare_hoists(const void* a, const void* b) {
+    const Hoist* x = (const Hoist*)a;
+    const Hoist* y = (const Hoist*)b;
+    return x->line != y->line ? x->line - y->line : x->s - y->s;
+}
+
+/* Hoist what each loop's own lines compute from values the loop never
+   changes, such as N*N or A(K) with K fixed; a line in nested loops
+   belongs to the innermost. Returns the hoists by line and offset. */
+static int plan_hoists(Program* prog, Hoist** out) {
+    int n = prog->num_lines, nh = 0, cap = 1, temps = 0;
+    int* owner = (int*)malloc((size_t)(n + 1) * sizeof(int));
+    StackExpr* st = (StackExpr*)malloc((size_t)(prog->stack_max + 1) * sizeof(StackExpr));
+    Hoist* h;
+    for (int i = 0; i < n; i++) {
+        owner[i] = -1;
+        cap += prog->lines[i].code_len / 2;
+    }
+    h = (Hoist*)malloc((size_t)cap * sizeof(Hoist));
+    for (int k = 0; k < prog->num_loops; k++) {
+        for (int i = prog->loops[k].first; i <= prog->loops[k].last; i++)
+            if (owner[i] < 0) owner[i] = k;
+    }
+    for (int i = 0; i < n; i++) {
+        if (owner[i] >= 0 && !prog->lines[i].unreachable) nh = hoist_line(prog, h, nh, &temps, owner[i], i, st);
+    }
+    qsort(h, (size_t)nh, sizeof(Hoist), compare_hoists);
+    free(owner);
+    free(st);
+    *out = h;
+    return nh;
+}
+
+/* Lay out the preheader of loop k at c + pc; returns the offset after it */
+static int emit_preheader(Program* prog, int k, const Hoist* h, int nh, int* c, int pc) {
+    Loop* L = &prog->loops[k];
+    L->pre = pc;
+    for (int i = 0; i < nh; i++) {
+        if (h[i].loop != k || !h[i].fresh) continue;
+        memcpy(c + pc, prog->lines[h[i].line].code + h[i].s, (size_t)(h[i].e - h[i].s) * sizeof(int));
+        pc += h[i].e - h[i].s;
+        c[pc++] = OP_STORE;
+        c[pc++] = NUM_VARS + h[i].temp;
+    }
+    L->body = pc;
+    return pc;
+}
+
+/* Code offset for the jump at offset `at` to line number num, or -1 if
+   there is no such line; threaded when optimizing */
+static int link_target(Interp* in, int num, int at) {
+    Program* prog = in->prog;
+    int i = find_line(prog->lines, prog->num_lines, num), j;
+    if (i < 0) return -1;
+    if (!in->optimize) return prog->line_pc[i];
+    j = thread_line(prog, i);
+    if (j != i) prog->num_threaded++;
+    if (prog->line_loop && prog->line_loop[j] >= 0) {
+        const Loop* L = &prog->loops[prog->line_loop[j]];
+        if (at >= L->pre && at < L->end) return L->body;    /* back jump: past the preheader */
+    }
+    return prog->line_pc[j];
+}
+
+/*
+ * Compiling is incremental. Each line keeps its compiled statement, jumps
+ * still naming line numbers, until the line is edited, so a RUN after
+ * changing one line compiles just that line. Linking then lays the lines
+ * out back to back and resolves jump targets to code offsets so taken
+ * jumps never search program[]; only this pass sees line indices and code
+ * offsets, which shift whenever a line is added or deleted. Missing
+ * GOTO/IF targets keep the lookup opcode. When optimizing, unreachable
+ * lines are left out (their line_pc is that of the next line laid out),
+ * jumps are threaded and loop-invariant values are hoisted, unless the
+ * code is instrumented; LIST and SAVE still show every line. The DATA
+ * values of every line, reachable or not, are gathered into one pool in
+ * line order, and RESTORE targets become offsets into it.
+ */
+static void compile_program(Interp* in) {
+    Program* prog = in->prog;
+    int len = 1, pc = 0, nh = 0;
+    Hoist* h = NULL;
+    int* c;
+    int* par_end;                   /* per line: the PARALLEL FOR line whose NEXT it follows, or -1 */
+    unsigned int* par_sums;
+    prog->stack_max = 0;
+    for (int i = 0; i < prog->num_lines; i++) {
+        Line* ln = &prog->lines[i];
+        if (!ln->code) {
+            in->code_buf_len = 0;
+            in->stack_max = 0;
+            compile_line(in, ln->tok);
+            ln->code = (int*)arena_alloc(&prog->line_arena, (size_t)in->code_buf_len * sizeof(int));
+            memcpy(ln->code, in->code_buf, (size_t)in->code_buf_len * sizeof(int));
+            ln->code_len = in->code_buf_len;
+            ln->stack_max = in->stack_max;
+            ln->data_len = parse_data(in, ln);
+        }
+        len += ln->code_len + (in->profile ? 2 : 0) + (in->trace ? 2 : 0);
+        if (ln->stack_max > prog->stack_max) prog->stack_max = ln->stack_max;
+        ln->unreachable = 0;
+    }
+    if (in->optimize) find_reachable(prog);
+
+    arena_reset(&prog->code_arena);
+    prog->loops = NULL;
+    prog->line_loop = NULL;
+    prog->num_loops = 0;
+    if (in->optimize && !in->profile && !in->trace) {
+        find_loops(prog);
+        nh = plan_hoists(prog, &h);
+        for (int k = 0; k < nh; k++) len += h[k].e - h[k].s + 2;
+    }
+    par_end = (int*)malloc((size_t)(prog->num_lines + 1) * sizeof(int));
+    par_sums = (unsigned int*)calloc((size_t)prog->num_lines + 1, sizeof(unsigned int));
+    for (int i = 0; i <= prog->num_lines; i++) par_end[i] = -1;
+    for (int i = 0; i < prog->num_lines && !in->profile && !in->trace; i++) {
+        const Line* ln = &prog->lines[i];
+        int m;
+        if (ln->unreachable || line_op(ln, OP_PAR) < 0 || (m = match_next(prog, i)) < 0) continue;
+        if (!par_loop_ok(prog, i, m, &par_sums[i])) continue;
+        par_end[m + 1] = i;
+        len += 2;
+    }
+    prog->line_data = (int*)arena_alloc(&prog->code_arena, (size_t)(prog->num_lines + 1) * sizeof(int));
+    prog->data_len = 0;
+    for (int i = 0; i < prog->num_lines; i++) {
+        prog->line_data[i] = prog->data_len;
+        prog->data_len += prog->lines[i].data_len;
+    }
+    prog->line_data[prog->num_lines] = prog->data_len;
+    prog->data = (int*)arena_alloc(&prog->code_arena, (size_t)(prog->data_len + 1) * sizeof(int));
+    for (int i = 0; i < prog->num_lines; i++)
+        if (prog->lines[i].data_len) memcpy(prog->data + prog->line_data[i], prog->lines[i].data, (size_t)prog->lines[i].data_len * sizeof(int));
+    prog->line_pc = (int*)arena_alloc(&prog->code_arena, (size_t)(prog->num_lines + 1) * sizeof(int));
+    prog->code = c = (int*)arena_alloc(&prog->code_arena, (size_t)len * sizeof(int));
+    for (int i = 0, k = 0; i < prog->num_lines; i++) {
+        const Line* ln = &prog->lines[i];
+        int from = 0;
+        prog->line_pc[i] = pc;
+        if (par_end[i] >= 0) { c[pc++] = OP_PEND; c[pc++] = par_end[i]; }
+        if (ln->unreachable) continue;
+        if (in->profile) { c[pc++] = OP_LINE; c[pc++] = i; }
+        if (in->trace) { c[pc++] = OP_TRACE; c[pc++] = i; }
+        if (prog->line_loop && prog->line_loop[i] >= 0) pc = emit_preheader(prog, prog->line_loop[i], h, nh, c, pc);
+        for (; k < nh && h[k].line == i; k++) {
+            memcpy(c + pc, ln->code + from, (size_t)(h[k].s - from) * sizeof(int));
+            pc += h[k].s - from;
+            c[pc++] = OP_LOAD;
+            c[pc++] = NUM_VARS + h[k].temp;
+            from = h[k].e;
+        }
+        memcpy(c + pc, ln->code + from, (size_t)(ln->code_len - from) * sizeof(int));
+        pc += ln->code_len - from;
+    }
+    for (int k = 0; k < prog->num_loops; k++) {
+        Loop* L = &prog->loops[k];
+        L->end = L->last + 1 < prog->num_lines ? prog->line_pc[L->last + 1] : pc;
+    }
+    free(h);
+    for (int i = 0; i < prog->num_lines; i++) {
+        /* link each parallel loop to its exit, past the OP_PEND */
+        int at = prog->line_pc[i], m;
+        if (line_op(&prog->lines[i], OP_PAR) < 0 || (m = match_next(prog, i)) < 0 || par_end[m + 1] != i) continue;
+        while (c[at] != OP_PAR) at += op_len[c[at]];
+        c[at + 1] = m + 1 < prog->num_lines ? prog->line_pc[m + 1] + 2 : pc;
+        c[at + 2] = (int)par_sums[i];
+    }
+    free(par_end);
+    free(par_sums);
+    c[pc++] = OP_END;
+    prog->code_len = pc;
+
+    prog->num_threaded = 0;
+    for (int at = 0; at < prog->code_len; at += op_len[c[at]]) {
+        int op = c[at];
+        if (op == OP_GOSUB) {
+            /* a missing line falls through: jump to the next op instead */
+            int t = link_target(in, c[at + 1], at);
+            if (t < 0) { c[at] = OP_JMP; t = at + 2; }
+            c[at + 1] = t;
+        } else if (op == OP_GOTO || op == OP_IFGOTO) {
+            int t = link_target(in, c[at + 1], at);
+            if (t < 0) continue;
+            c[at] = (op == OP_GOTO) ? OP_JMP : OP_JNZ;
+            c[at + 1] = t;
+            if (in->optimize && op == OP_GOTO && c[t] == OP_END) {
+                c[at] = OP_END;     /* GOTO to END; the operand becomes a dead END */
+                c[at + 1] = OP_END;
+                prog->num_threaded++;
+            }
+        } else if (op >= OP_JEQVC && op <= OP_JGEVV) {
+            /* fused compare: a missing line falls through to the next op */
+            int t = link_target(in, c[at + 3], at);
+            c[at + 3] = t >= 0 ? t : at + 4;
+        } else if (op == OP_RESTORE) {
+            c[at + 1] = data_offset(prog, c[at + 1]);
+        }
+    }
+    map_code_lines(prog);
+    prog->code_valid = 1;
+    in->stop_pc = -1;
+}
+
+/*
+ * Native code tier for x86-64 (System V). The VM counts taken backward
+ * jumps per target; once a loop head gets hot, the run of lines starting
+ * there is translated to machine code, as long as every opcode in a line
+ * is supported (PRINT, DIM, END, FOR, GOSUB and RETURN end the region;
+ * NEXT is supported for loops on the region itself). The code keeps vars[]
+ * in rbx, the arrays[] and array_sizes[] tables in r12/r13, the top of the
+ * value stack in eax and the rest on the machine stack. The variables the
+ * region uses most live in registers from entry to exit, written back to
+ * vars[] on the way out. Jumps inside the region stay native, backward
+ * ones after charging in->fuel like the VM; any other exit, or running out
+ * of fuel, returns the code offset at which the VM resumes. Array accesses
+ * mirror eval_primary(): out of range reads 0 and out of range writes are
+ * dropped.
+ */
+#ifndef JIT_SUPPORTED
+#if defined(__x86_64__) && (defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__))
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+#endif
+
+#define JIT_HOT     100     /* backward jumps to a head before compiling it */
+#define JIT_REGS    7       /* variables cached in registers per region */
+#define JIT_NEVER   (-0x7fffffff)
+
+#if JIT_SUPPORTED
+typedef int (*JitFn)(int* vars, int** arrays, int* sizes);
+
+typedef struct JitEntry {
+    void* mem;
+    size_t size;
+    JitFn fn;
+} JitEntry;
+
+typedef struct JitFix { int at; int pc; int from; } JitFix;
+
+static void jb_byte(Interp* in, int b) {
+    if (in->jb_len == in->jb_cap) {
+        in->jb_cap = in->jb_cap ? in->jb_cap * 2 : 4096;
+        in->jb = (unsigned char*)realloc(in->jb, (size_t)in->jb_cap);
+    }
+    in->jb[in->jb_len++] = (unsigned char)b;
+}
+
+static void jb_bytes(Interp* in, const char* s, int n) {
+    for (int i = 0; i < n; i++) jb_byte(in, (unsigned char)s[i]);
+}
+
+static void jb_int(Interp* in, int v) {
+    unsigned int u = (unsigned int)v;
+    jb_byte(in, (int)(u & 0xff)); jb_byte(in, (int)(u >> 8 & 0xff));
+    jb_byte(in, (int)(u >> 16 & 0xff)); jb_byte(in, (int)(u >> 24));
+}
+
+static void jb_patch(Interp* in, int at, int target) {
+    unsigned int rel = (unsigned int)(target - (at + 4));
+    in->jb[at] = (unsigned char)rel; in->jb[at + 1] = (unsigned char)(rel >> 8);
+    in->jb[at + 2] = (unsigned char)(rel >> 16); in->jb[at + 3] = (unsigned char)(rel >> 24);
+}
+
+/* rel32 operand that will point at the native code for bytecode offset pc,
+   for the jump instruction at offset from (-1 for exits) */
+static void jb_jump_to(Interp* in, int pc, int from) {
+    if (in->jfix_len == in->jfix_cap) {
+        in->jfix_cap = in->jfix_cap ? in->jfix_cap * 2 : 64;
+        in->jfix = (JitFix*)realloc(in->jfix, (size_t)in->jfix_cap * sizeof(JitFix));
+    }
+    in->jfix[in->jfix_len].at = in->jb_len;
+    in->jfix[in->jfix_len].pc = pc;
+    in->jfix[in->jfix_len].from = from;
+    in->jfix_len++;
+    jb_int(in, 0);
+}
+
+/* op reg, rm on two registers; r8-r15 get a REX prefix */
+static void jb_rr(Interp* in, int op, int reg, int rm) {
+    if (reg >= 8 || rm >= 8) jb_byte(in, 0x40 | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0));
+    jb_byte(in, op);
+    jb_byte(in, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/* op reg, [rbx + v*4] */
+static void jb_rm(Interp* in, int op, int reg, int v) {
+    if (reg >= 8) jb_byte(in, 0x44);
+    jb_byte(in, op);
+    jb_byte(in, 0x83 | (reg & 7) << 3);
+    jb_int(in, v * 4);
+}
+
+/* op reg, vars[v]: its register if it is cached, else memory */
+static void jb_var(Interp* in, int op, int reg, int v) {
+    if (in->jit_reg[v] >= 0) jb_rr(in, op, reg, in->jit_reg[v]);
+    else jb_rm(in, op, reg, v);
+}
+
+static void jb_push_tos(Interp* in, int depth) { if (depth > 0) jb_byte(in, 0x50); }   /* push rax */
+static void jb_pop_tos(Interp* in, int depth) { if (depth > 0) jb_byte(in, 0x58); }    /* pop rax */
+
+/* eax = arrays[a][eax], or 0 when a is undimensioned or eax out of range */
+static void jb_load_array(Interp* in, int a) {
+    jb_bytes(in, "\x49\x8b\x8c\x24", 4); jb_int(in, a * 8);     /* mov rcx, [r12 + a*8] */
+    jb_bytes(in, "\x48\x85\xc9", 3);                        /* test rcx, rcx */
+    jb_bytes(in, "\x74\x0e", 2);                            /* jz zero */
+    jb_bytes(in, "\x41\x3b\x85", 3); jb_int(in, a * 4);         /* cmp eax, [r13 + a*4] */
+    jb_bytes(in, "\x73\x05", 2);                            /* jae zero */
+    jb_bytes(in, "\x8b\x04\x81", 3);                        /* mov eax, [rcx + rax*4] */
+    jb_bytes(in, "\xeb\x02", 2);                            /* jmp done */
+    jb_bytes(in, "\x31\xc0", 2);                            /* zero: xor eax, eax */
+}
+
+/* arrays[a][ecx] = eax when in range */
+static void jb_store_array(Interp* in, int a) {
+    jb_bytes(in, "\x49\x8b\x94\x24", 4); jb_int(in, a * 8);     /* mov rdx, [r12 + a*8] */
+    jb_bytes(in, "\x48\x85\xd2", 3);                        /* test rdx, rdx */
+    jb_bytes(in, "\x74\x0c", 2);                            /* jz skip */
+    jb_bytes(in, "\x41\x3b\x8d", 3); jb_int(in, a * 4);         /* cmp ecx, [r13 + a*4] */
+    jb_bytes(in, "\x73\x03", 2);                            /* jae skip */
+    jb_bytes(in, "\x89\x04\x8a", 3);                        /* mov [rdx + rcx*4], eax */
+}
+
+/* Value stack depth after op, or -1 if the op cannot be compiled at this depth */
+static int jit_depth_after(const int* ip, int depth) {
+    switch (ip[0]) {
+    case OP_PUSH: case OP_LOAD: case OP_LOADAV: return depth + 1;
+    case OP_LOADA: case OP_NEG: case OP_SHL: return depth >= 1 ? depth : -1;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+    case OP_EQ: case OP_NE: case OP_LT: case OP_GT: case OP_LE: case OP_GE:
+        return depth >= 2 ? depth - 1 : -1;
+    case OP_STORE: case OP_STOREAV: case OP_IFGOTO: return depth >= 1 ? depth - 1 : -1;
+    case OP_STOREA: return depth >= 2 ? depth - 2 : -1;
+    case OP_JNZ: return depth == 1 ? 0 : -1;
+    case OP_NEXT: return depth == 0 ? 0 : -1;
+    case OP_JMP: case OP_GOTO: case OP_INCV: return depth;
+    default:
+        if (ip[0] >= OP_JEQVC && ip[0] <= OP_JGEVV) return depth;
+        return -1;
+    }
+}
+
+/* Can every op of the line occupying code[from, to) be compiled? */
+static int jit_line_ok(const Program* prog, int from, int to) {
+    int depth = 0;
+    for (int pc = from; pc < to; pc += op_len[prog->code[pc]]) {
+        depth = jit_depth_after(prog->code + pc, depth);
+        if (depth < 0) return 0;
+    }
+    return depth == 0;
+}
+
+static void jit_exit(Interp* in, int pc) {
+    jb_byte(in, 0xb8); jb_int(in, pc);                          /* mov eax, pc */
+    jb_bytes(in, "\xe9", 1); jb_jump_to(in, -1, -1);                /* jmp epilogue */
+}
+
+/* NEXT at offset pc in a region starting at start. The common case stays
+   native: the innermost frame is a FOR on var (any FOR if var < 0) whose
+   body is the region itself. Otherwise leave for the VM's ctrl_next(). */
+static void jit_next(Interp* in, int pc, int var, int start) {
+    int sp_off = (int)((char*)&in->ctrl_sp - (char*)in->vars);
+    int slow[3], n = 0, done;
+    jb_bytes(in, "\x8b\x8b", 2); jb_int(in, sp_off);          /* mov ecx, [rbx + ctrl_sp] */
+    jb_bytes(in, "\xff\xc9\x0f\x88", 4);                      /* dec ecx; js slow */
+    slow[n++] = in->jb_len; jb_int(in, 0);
+    jb_bytes(in, "\xc1\xe1\x04", 3);                          /* shl ecx, 4 */
+    jb_bytes(in, "\x48\x8d\x8c\x0b", 4);                      /* lea rcx, [rbx + rcx + ctrl] */
+    jb_int(in, (int)((char*)in->ctrl - (char*)in->vars));
+    if (var >= 0) {
+        jb_bytes(in, "\x81\x39", 2); jb_int(in, var);          /* cmp dword [rcx], var; jne slow */
+        jb_bytes(in, "\x0f\x85", 2);
+    } else {
+        jb_bytes(in, "\x83\x39\x00\x0f\x8c", 5);             /* cmp dword [rcx], 0; jl slow */
+    }
+    slow[n++] = in->jb_len; jb_int(in, 0);
+    jb_bytes(in, "\x81\x79\x0c", 3); jb_int(in, start);       /* cmp dword [rcx + pc], start; jne slow */
+    jb_bytes(in, "\x0f\x85", 2);
+    slow[n++] = in->jb_len; jb_int(in, 0);
+    if (var >= 0 && in->jit_reg[var] >= 0) {
+        int r = in->jit_reg[var];
+        jb_byte(in, 0x48 | (r >= 8)); jb_byte(in, 0x63); jb_byte(in, 0xc0 | (r & 7));   /* movsxd rax, reg */
+    } else {
+        jb_bytes(in, "\x8b\x11\x48\x63\x04\x93", 6);        /* mov edx, [rcx]; movsxd rax, [rbx + rdx*4] */
+    }
+    jb_bytes(in, "\x4c\x63\x41\x08\x4c\x01\xc0", 7);        /* movsxd r8, [rcx + step]; add rax, r8 */
+    if (var >= 0 && in->jit_reg[var] >= 0) jb_rr(in, 0x89, 0, in->jit_reg[var]);       /* mov reg, eax */
+    else jb_bytes(in, "\x89\x04\x93", 3);                        /* mov [rbx + rdx*4], eax */
+    jb_bytes(in, "\x4c\x63\x49\x04", 4);                        /* movsxd r9, [rcx + limit] */
+    jb_bytes(in, "\x4d\x85\xc0\x78\x0b", 5);                 /* test r8, r8; js down */
+    jb_bytes(in, "\x4c\x39\xc8\x0f\x8e", 5);                 /* cmp rax, r9; jle start */
+    jb_jump_to(in, start, pc);
+    jb_bytes(in, "\xeb\x09", 2);                              /* jmp done */
+    jb_bytes(in, "\x4c\x39\xc8\x0f\x8d", 5);                 /* down: cmp rax, r9; jge start */
+    jb_jump_to(in, start, pc);
+    jb_bytes(in, "\xff\x8b", 2); jb_int(in, sp_off);          /* done: dec dword [rbx + ctrl_sp] */
+    jb_byte(in, 0xe9); done = in->jb_len; jb_int(in, 0);       /* jmp next */
+    for (int i = 0; i < n; i++) jb_patch(in, slow[i], in->jb_len);
+    jit_exit(in, pc);                                           /* slow: */
+    jb_patch(in, done, in->jb_len);
+}
+
+/* Cache the variables the region code[start, end) uses most in the
+   registers of regs[], none if a NEXT without a variable could step one
+   behind the code's back */
+static void jit_pick_regs(Interp* in, int start, int end) {
+    static const signed char regs[JIT_REGS] = { 14, 15, 5, 6, 7, 10, 11 };  /* r14 r15 rbp rsi rdi r10 r11 */
+    const int* code = in->prog->code;
+    int uses[NUM_VARS + NUM_TEMPS] = { 0 };
+    for (int v = 0; v < NUM_VARS + NUM_TEMPS; v++) in->jit_reg[v] = -1;
+    for (int pc = start; pc < end; pc += op_len[code[pc]]) {
+        const int* ip = code + pc;
+        switch (ip[0]) {
+        case OP_LOAD: case OP_STORE: case OP_INCV: uses[ip[1]]++; break;
+        case OP_LOADAV: case OP_STOREAV: uses[ip[2]]++; break;
+        case OP_NEXT:
+            if (ip[1] < 0) return;
+            uses[ip[1]]++;
+            break;
+        default:
+            if (ip[0] >= OP_JEQVC && ip[0] <= OP_JGEVV) uses[ip[1]]++;
+            if (ip[0] >= OP_JEQVV && ip[0] <= OP_JGEVV) uses[ip[2]]++;
+            break;
+        }
+    }
+    for (int k = 0; k < JIT_REGS; k++) {
+        int best = -1;
+        for (int v = 0; v < NUM_VARS + NUM_TEMPS; v++)
+            if (uses[v] && in->jit_reg[v] < 0 && (best < 0 || uses[v] > uses[best])) best = v;
+        if (best < 0) break;
+        in->jit_reg[best] = regs[k];
+    }
+}
+
+/* Translate the region starting at offset start in line head_line (past
+   a loop preheader, or the line's start); returns its entry or JIT_NEVER */
+static int jit_compile(Interp* in, int head_line, int start) {
+    Program* prog = in->prog;
+    static const unsigned char setcc[6] = { 0x94, 0x95, 0x9c, 0x9f, 0x9e, 0x9d };
+    static const unsigned char jcc[6] = { 0x84, 0x85, 0x8c, 0x8f, 0x8e, 0x8d };
+    int end = start, last = head_line;
+    int* native;
+    int epilogue, depth = 0;
+
+    /* Region: consecutive compilable lines starting at the head */
+    while (last < prog->num_lines) {
+        int to = last + 1 < prog->num_lines ? prog->line_pc[last + 1] : prog->code_len - 1;
+        if (!jit_line_ok(prog, last == head_line ? start : prog->line_pc[last], to)) break;
+        end = to;
+        last++;
+    }
+    if (end == start) return JIT_NEVER;
+    jit_pick_regs(in, start, end);
+
+    native = (int*)malloc((size_t)(end - start + 1) * sizeof(int));
+    for (int i = 0; i <= end - start; i++) native[i] = -1;
+    in->jb_len = 0;
+    in->jfix_len = 0;
+    jb_bytes(in, "\x53\x41\x54\x41\x55", 5);                /* push rbx; push r12; push r13 */
+    jb_bytes(in, "\x55\x41\x56\x41\x57", 5);                /* push rbp; push r14; push r15 */
+    jb_bytes(in, "\x48\x89\xfb\x49\x89\xf4\x49\x89\xd5", 9); /* mov rbx, rdi; mov r12, rsi; mov r13, rdx */
+    for (int v = 0; v < NUM_VARS + NUM_TEMPS; v++)
+        if (in->jit_reg[v] >= 0) jb_rm(in, 0x8b, in->jit_reg[v], v);  /* mov reg, [rbx + v*4] */
+
+    for (int pc = start; pc < end; pc += op_len[prog->code[pc]]) {
+        const int* ip = prog->code + pc;
+        int op = ip[0];
+        native[pc - start] = in->jb_len;
+        switch (op) {
+        case OP_PUSH:
+            jb_push_tos(in, depth);
+            jb_byte(in, 0xb8); jb_int(in, ip[1]);               /* mov eax, k */
+            break;
+        case OP_LOAD:
+            jb_push_tos(in, depth);
+            jb_var(in, 0x8b, 0, ip[1]);                         /* mov eax, v */
+            break;
+        case OP_LOADA:
+            jb_load_array(in, ip[1]);
+            break;
+        case OP_LOADAV:
+            jb_push_tos(in, depth);
+            jb_var(in, 0x8b, 0, ip[2]);                         /* mov eax, v */
+            jb_load_array(in, ip[1]);
+            break;
+        case OP_ADD: jb_bytes(in, "\x59\x01\xc8", 3); break;             /* pop rcx; add eax, ecx */
+        case OP_SUB: jb_bytes(in, "\x59\x29\xc1\x89\xc8", 5); break;     /* pop rcx; sub ecx, eax; mov eax, ecx */
+        case OP_MUL: jb_bytes(in, "\x59\x0f\xaf\xc1", 4); break;         /* pop rcx; imul eax, ecx */
+        case OP_DIV:
+            jb_bytes(in, "\x59\x41\x89\xc0", 4);            /* pop rcx; mov r8d, eax */
+            jb_bytes(in, "\x45\x85\xc0\x74\x08", 5);        /* test r8d, r8d; jz zero */
+            jb_bytes(in, "\x89\xc8\x99\x41\xf7\xf8", 6);    /* mov eax, ecx; cdq; idiv r8d */
+            jb_bytes(in, "\xeb\x02\x31\xc0", 4);            /* jmp done; zero: xor eax, eax */
+            break;
+        case OP_NEG: jb_bytes(in, "\xf7\xd8", 2); break;                 /* neg eax */
+        case OP_SHL: jb_bytes(in, "\xc1\xe0", 2); jb_byte(in, ip[1]); break; /* shl eax, k */
+        case OP_EQ: case OP_NE: case OP_LT: case OP_GT: case OP_LE: case OP_GE:
+            jb_bytes(in, "\x59\x39\xc1\x0f", 4);            /* pop rcx; cmp ecx, eax; setcc al */
+            jb_byte(in, setcc[op - OP_EQ]); jb_byte(in, 0xc0);
+            jb_bytes(in, "\x0f\xb6\xc0", 3);                /* movzx eax, al */
+            break;
+        case OP_STORE:
+            jb_var(in, 0x89, 0, ip[1]);                         /* mov v, eax */
+            jb_pop_tos(in, depth - 1);
+            break;
+        case OP_STOREA:
+            jb_byte(in, 0x59);                              /* pop rcx */
+            jb_store_array(in, ip[1]);
+            jb_pop_tos(in, depth - 2);
+            break;
+        case OP_STOREAV:
+            jb_var(in, 0x8b, 1, ip[2]);                         /* mov ecx, v */
+            jb_store_array(in, ip[1]);
+            jb_pop_tos(in, depth - 1);
+            break;
+        case OP_INCV:
+            jb_var(in, 0x81, 0, ip[1]); jb_int(in, ip[2]);      /* add v, k */
+            break;
+        case OP_JMP:
+            jb_byte(in, 0xe9); jb_jump_to(in, ip[1], pc);
+            break;
+        case OP_JNZ:
+            jb_bytes(in, "\x85\xc0\x0f\x85", 4); jb_jump_to(in, ip[1], pc);        /* test eax, eax; jnz */
+            break;
+        case OP_NEXT:
+            jit_next(in, pc, ip[1], start);
+            break;
+        case OP_GOTO:       /* unresolved: falls through */
+            break;
+        case OP_IFGOTO:     /* unresolved: drop the condition */
+            jb_pop_tos(in, depth - 1);
+            break;
+        default:
+            if (op >= OP_JEQVC && op <= OP_JGEVC) {
+                jb_var(in, 0x81, 7, ip[1]); jb_int(in, ip[2]);                      /* cmp v, k */
+                jb_byte(in, 0x0f); jb_byte(in, jcc[op - OP_JEQVC]); jb_jump_to(in, ip[3], pc);
+            } else {
+                jb_var(in, 0x8b, 1, ip[1]);                                         /* mov ecx, v */
+                jb_var(in, 0x3b, 1, ip[2]);                                         /* cmp ecx, w */
+                jb_byte(in, 0x0f); jb_byte(in, jcc[op - OP_JEQVV]); jb_jump_to(in, ip[3], pc);
+            }
+            break;
+        }
+        depth = jit_depth_after(ip, depth);
+    }
+    native[end - start] = in->jb_len;
+    jit_exit(in, end);
+
+    /* Exit stubs for jumps leaving the region, then the shared epilogue */
+    for (int i = 0, n = in->jfix_len; i < n; i++) {
+        int pc = in->jfix[i].pc;
+        if (pc < 0) continue;
+        if (pc >= start && pc <= end && (pc == end || native[pc - start] >= 0)) {
+            int from = in->jfix[i].from;
+            if (from >= 0 && pc <= from) {
+                /* backward: charge in->fuel, which sits in the same struct as
+                   vars[] and so is rbx-relative; exit to the VM when it runs out */
+                jb_patch(in, in->jfix[i].at, in->jb_len);
+                jb_bytes(in, "\x48\x81\xab", 3);                 /* sub qword [rbx + fuel], steps */
+                jb_int(in, (int)((char*)&in->fuel - (char*)in->vars));
+                jb_int(in, prog->pc_line[from] - prog->pc_line[pc] + 1);
+                jb_bytes(in, "\x0f\x8d", 2); jb_int(in, 0);      /* jge target */
+                jb_patch(in, in->jb_len - 4, native[pc - start]);
+                jit_exit(in, pc);
+            } else {
+                jb_patch(in, in->jfix[i].at, native[pc - start]);
+            }
+        } else {
+            int at = in->jfix[i].at;
+            jb_patch(in, at, in->jb_len);
+            jit_exit(in, pc);
+        }
+    }
+    epilogue = in->jb_len;
+    for (int v = 0; v < NUM_VARS + NUM_TEMPS; v++)
+        if (in->jit_reg[v] >= 0) jb_rm(in, 0x89, in->jit_reg[v], v);  /* mov [rbx + v*4], reg */
+    jb_bytes(in, "\x41\x5f\x41\x5e\x5d", 5);                /* pop r15; pop r14; pop rbp */
+    jb_bytes(in, "\x41\x5d\x41\x5c\x5b\xc3", 6);            /* pop r13; pop r12; pop rbx; ret */
+    for (int i = 0; i < in->jfix_len; i++) {
+        if (in->jfix[i].pc < 0) jb_patch(in, in->jfix[i].at, epilogue);
+    }
+    free(native);
+
+    size_t size = ((size_t)in->jb_len + 4095) & ~(size_t)4095;
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return JIT_NEVER;
+    memcpy(mem, in->jb, (size_t)in->jb_len);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return JIT_NEVER;
+    }
+    if (in->num_jit_entries == in->jit_entries_cap) {
+        in->jit_entries_cap = in->jit_entries_cap ? in->jit_entries_cap * 2 : 16;
+        in->jit_entries = (JitEntry*)realloc(in->jit_entries, (size_t)in->jit_entries_cap * sizeof(JitEntry));
+    }
+    in->jit_entries[in->num_jit_entries].mem = mem;
+    in->jit_entries[in->num_jit_entries].size = size;
+    memcpy(&in->jit_entries[in->num_jit_entries].fn, &mem, sizeof(mem));
+    return -1 - in->num_jit_entries++;
+}
+
+/* Called by the VM on a taken backward jump to code offset pc. Returns the
+   offset to continue at: pc itself, or wherever native code left off. */
+static int jit_backedge(Interp* in, int pc) {
+    Program* prog = in->prog;
+    int c = in->jit_count[pc];
+    if (c >= 0) {
+        if (++c < JIT_HOT) { in->jit_count[pc] = c; return pc; }
+        /* backward jump targets are line starts or loop bodies past a preheader */
+        int line = prog->pc_line[pc], ok = prog->line_pc[line] == pc;
+        for (int k = 0; k < prog->num_loops && !ok; k++) ok = prog->loops[k].body == pc;
+        c = ok ? jit_compile(in, line, pc) : JIT_NEVER;
+        in->jit_count[pc] = c;
+    }
+    if (c == JIT_NEVER) return pc;
+    return in->jit_entries[-1 - c].fn(in->vars, in->arrays, in->array_sizes);
+}
+
+static void jit_begin(Interp* in) {
+    if (!in->jit_enabled) return;
+    in->jit_count = (int*)calloc((size_t)in->prog->code_len, sizeof(int));
+}
+
+static void jit_end(Interp* in) {
+    for (int i = 0; i < in->num_jit_entries; i++) munmap(in->jit_entries[i].mem, in->jit_entries[i].size);
+    in->num_jit_entries = 0;
+    free(in->jit_count);
+    in->jit_count = NULL;
+}
+
+static void jit_free(Interp* in) {
+    free(in->jit_entries);
+    free(in->jb);
+    free(in->jfix);
+}
+
+/* Backward jump to t: continue in native code once the loop is hot */
+#define VM_JIT(t)   if (in->jit_count) { in->fuel = fuel; t = jit_backedge(in, t); fuel = in->fuel; }
+#else
+#define VM_JIT(t)
+static void jit_begin(Interp* in) { (void)in; }
+static void jit_end(Interp* in) { (void)in; }
+static void jit_free(Interp* in) { (void)in; }
+#endif
+
+/*
+ * Profiler. With PROFILE ON every line is compiled with a leading OP_LINE,
+ * which charges the time since the previous OP_LINE to the line that was
+ * running and counts the new one; a line that does not follow the previous
+ * one was reached by a jump, which is counted as an edge. With PROFILE OFF
+ * nothing is emitted and the VM runs exactly as before. Lines carrying
+ * OP_LINE are never native-compiled, so a profile shows the VM.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define prof_ticks()    __rdtsc()
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define prof_ticks()    __rdtsc()
+#else
+#define prof_ticks()    clock_ns()
+#endif
+
+#define PROFILE_TOP     20
+
+/* Monotonic wall clock in nanoseconds */
+static unsigned long long clock_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER t, f;
+    QueryPerformanceCounter(&t);
+    QueryPerformanceFrequency(&f);
+    return (unsigned long long)((double)t.QuadPart * 1e9 / (double)f.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+#endif
+}
+
+typedef struct {
+    int from, to;       /* line indices; from < 0 marks an empty slot */
+    long long count;
+} ProfEdge;
+
+typedef struct Profile {
+    long long* count;           /* per line: executions */
+    unsigned long long* ticks;  /* per line: accumulated prof_ticks() */
+    ProfEdge* edges;            /* open addressing on (from, to) */
+    int num_edges, edges_cap;
+    int line;                   /* line running now, -1 before the first */
+    unsigned long long last;    /* prof_ticks() when it started */
+    unsigned long long start_ticks, start_ns;
+} Profile;
+
+static void profile_free(Profile* pr) {
+    if (!pr) return;
+    free(pr->count);
+    free(pr->ticks);
+    free(pr->edges);
+    free(pr);
+}
+
+static void profile_begin(Interp* in) {
+    int n = in->prog->num_lines;
+    Profile* pr = (Profile*)calloc(1, sizeof(Profile));
+    profile_free(in->prof);
+    pr->count = (long long*)calloc((size_t)n, sizeof(long long));
+    pr->ticks = (unsigned long long*)calloc((size_t)n, sizeof(unsigned long long));
+    pr->edges_cap = 64;
+    pr->edges = (ProfEdge*)malloc((size_t)pr->edges_cap * sizeof(ProfEdge));
+    for (int i = 0; i < pr->edges_cap; i++) pr->edges[i].from = -1;
+    pr->line = -1;
+    pr->start_ns = clock_ns();
+    pr->start_ticks = pr->last = prof_ticks();
+    in->prof = pr;
+}
+
+static ProfEdge* profile_edge_slot(ProfEdge* edges, int cap, int from, int to) {
+    unsigned int i = ((unsigned int)from * 2654435761u ^ (unsigned int)to) & (unsigned int)(cap - 1);
+    while (edges[i].from >= 0 && (edges[i].from != from || edges[i].to != to)) i = (i + 1) & (unsigned int)(cap - 1);
+    return &edges[i];
+}
+
+static void profile_edge(Profile* pr, int from, int to) {
+    ProfEdge* e = profile_edge_slot(pr->edges, pr->edges_cap, from, to);
+    if (e->from < 0) {
+        if ((pr->num_edges + 1) * 2 > pr->edges_cap) {
+            int cap = pr->edges_cap * 2;
+            ProfEdge* edges = (ProfEdge*)malloc((size_t)cap * sizeof(ProfEdge));
+            for (int i = 0; i < cap; i++) edges[i].from = -1;
+            for (int i = 0; i < pr->edges_cap; i++) {
+                if (pr->edges[i].from >= 0) *profile_edge_slot(edges, cap, pr->edges[i].from, pr->edges[i].to) = pr->edges[i];
+            }
+            free(pr->edges);
+            pr->edges = edges;
+            pr->edges_cap = cap;
+            e = profile_edge_slot(edges, cap, from, to);
+        }
+        e->from = from;
+        e->to = to;
+        e->count = 0;
+        pr->num_edges++;
+    }
+    e->count++;
+}
+
+static void profile_line(Profile* pr, int line) {
+    unsigned long long now = prof_ticks();
+    if (pr->line >= 0) {
+        pr->ticks[pr->line] += now - pr->last;
+        if (line != pr->line + 1) profile_edge(pr, pr->line, line);
+    }
+    pr->count[line]++;
+    pr->line = line;
+    pr->last = now;
+}
+
+static void out_fmt(Interp* in, const char* fmt, ...) {
+    char buf[128];
+    va_list ap;
+    int n;
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n > 0) out_str(in, buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
+}
+
+static const Profile* sort_prof;
+
+static int compare_line_time(const void* a, const void* b) {
+    unsigned long long x = sort_prof->ticks[*(const int*)a], y = sort_prof->ticks[*(const int*)b];
+    return x < y ? 1 : x > y ? -1 : *(const int*)a - *(const int*)b;
+}
+
+static int compare_edge_count(const void* a, const void* b) {
+    long long x = ((const ProfEdge*)a)->count, y = ((const ProfEdge*)b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* Print the hottest lines by time and the most taken jumps */
+static void profile_report(Interp* in) {
+    Profile* pr = in->prof;
+    const Program* prog = in->prog;
+    unsigned long long now = prof_ticks(), total_ns = clock_ns() - pr->start_ns;
+    double ns_per_tick;
+    long long executed = 0;
+    int* order = (int*)malloc((size_t)(prog->num_lines + 1) * sizeof(int));
+    int n = 0, m = 0;
+    if (pr->line >= 0) pr->ticks[pr->line] += now - pr->last;
+    ns_per_tick = now > pr->start_ticks ? (double)total_ns / (double)(now - pr->start_ticks) : 0.0;
+    for (int i = 0; i < prog->num_lines; i++) {
+        executed += pr->count[i];
+        if (pr->count[i]) order[n++] = i;
+    }
+    sort_prof = pr;     /* qsort has no context argument; reports run one at a time */
+    qsort(order, (size_t)n, sizeof(int), compare_line_time);
+    out_fmt(in, "Profile: %lld lines executed in %.3f ms\n", executed, (double)total_ns / 1e6);
+    out_fmt(in, "%8s %14s %14s %6s\n", "line", "count", "time (ns)", "%time");
+    for (int k = 0; k < n && k < PROFILE_TOP; k++) {
+        int i = order[k];
+        double ns = (double)pr->ticks[i] * ns_per_tick;
+        out_fmt(in, "%8d %14lld %14.0f %6.1f\n", prog->lines[i].num, pr->count[i], ns,
+                total_ns ? ns * 100.0 / (double)total_ns : 0.0);
+    }
+    if (n > PROFILE_TOP) out_fmt(in, "(%d more lines)\n", n - PROFILE_TOP);
+    for (int i = 0; i < pr->edges_cap; i++) {
+        if (pr->edges[i].from >= 0) pr->edges[m++] = pr->edges[i];
+    }
+    qsort(pr->edges, (size_t)m, sizeof(ProfEdge), compare_edge_count);
+    if (m) out_fmt(in, "%8s %8s %14s\n", "from", "to", "jumps");
+    for (int k = 0; k < m && k < PROFILE_TOP; k++) {
+        out_fmt(in, "%8d %8d %14lld\n", prog->lines[pr->edges[k].from].num, prog->lines[pr->edges[k].to].num,
+                pr->edges[k].count);
+    }
+    if (m > PROFILE_TOP) out_fmt(in, "(%d more jumps)\n", m - PROFILE_TOP);
+    free(order);
+    profile_free(pr);
+    in->prof = NULL;
+}
+
+/*
+ * Execution trace. With TRACE ON every line is compiled with a leading
+ * OP_TRACE, which appends the line number and statement keyword to a ring
+ * that keeps the last TRACE_EVENTS events, marked as a jump when the line
+ * does not follow the previous one. Before that come the new values of
+ * watched variables that the previous line changed. With TRACE OFF
+ * nothing is emitted, so a trace costs nothing until it is switched on;
+ * like profiled lines, traced lines stay in the VM. See trace_save() for
+ * the file format.
+ */
+#define TRACE_EVENTS    16384   /* power of two */
+
+enum { TRACE_LINE = 1, TRACE_JUMP, TRACE_WRITE };
+
+typedef struct {
+    unsigned char type;
+    unsigned char arg;          /* keyword (TOK_* - TOK_PRINT + 1, 0 = none) or variable */
+    int val;                    /* line number or value written */
+} TraceEvent;
+
+typedef struct Trace {
+    TraceEvent ring[TRACE_EVENTS];
+    unsigned long long count;   /* events recorded; the ring holds the last ones */
+    int last;                   /* line index of the previous line event, or -1 */
+    int shadow[NUM_VARS];       /* watched variables as last recorded */
+} Trace;
+
+static int trace_save(const Interp* in, const char* filename);
+
+static void trace_record(Trace* tr, int type, int arg, int val) {
+    TraceEvent* e = &tr->ring[tr->count++ & (TRACE_EVENTS - 1)];
+    e->type = (unsigned char)type;
+    e->arg = (unsigned char)arg;
+    e->val = val;
+}
+
+static void trace_writes(Interp* in) {
+    Trace* tr = in->trace_buf;
+    for (int v = 0; v < NUM_VARS; v++) {
+        if ((in->trace_vars >> v & 1) && in->vars[v] != tr->shadow[v]) {
+            tr->shadow[v] = in->vars[v];
+            trace_record(tr, TRACE_WRITE, v, in->vars[v]);
+        }
+    }
+}
+
+static void trace_begin(Interp* in) {
+    if (!in->trace_buf) in->trace_buf = (Trace*)malloc(sizeof(Trace));
+    in->trace_buf->count = 0;
+    in->trace_buf->last = -1;
+    memcpy(in->trace_buf->shadow, in->vars, sizeof(in->vars));
+}
+
+static void trace_line(Interp* in, int line) {
+    Trace* tr = in->trace_buf;
+    const unsigned char* t;
+    if (!tr) return;            /* traced code loaded by CLOAD with TRACE OFF */
+    trace_writes(in);
+    t = in->prog->lines[line].tok;
+    while (*t == ' ' || *t == '\t') t++;
+    trace_record(tr, tr->last >= 0 && line != tr->last + 1 ? TRACE_JUMP : TRACE_LINE,
+                 *t >= TOK_PRINT ? *t - TOK_PRINT + 1 : 0, in->prog->lines[line].num);
+    tr->last = line;
+}
+
+/* After a run, however it ended: record the last line's writes and save
+   the ring to the -trace file, if any */
+static void trace_end(Interp* in) {
+    trace_writes(in);
+    if (in->trace_file && trace_save(in, in->trace_file) != 0)
+        fprintf(stderr, "Cannot create file: %s\n", in->trace_file);
+}
+
+/*
+ * Run limits. Every taken backward jump subtracts the number of lines it
+ * repeats from in->fuel, so counting costs one subtraction per loop
+ * iteration and straight-line code is never charged. When fuel runs out,
+ * run_check() looks at the interrupt flag, the clock and the step budget,
+ * and either hands out the next RUN_CHECK_STEPS or stops the run. Steps
+ * are program lines, so max_steps bounds the lines a run executes.
+ * run_check() also pauses the run for a checkpoint every checkpoint_every
+ * steps, handing out no more fuel than is left until the next one, and
+ * when a checkpoint was requested.
+ */
+#define RUN_CHECK_STEPS     65536
+#define RUN_UNLIMITED       (1LL << 62)
+#define RUN_CHECKPOINT      64      /* run_check(): save a checkpoint, then go on */
+
+static int run_check(Interp* in) {
+    int due;
+    if (in->interrupt || (in->par_parent && in->par_parent->interrupt)) return BASIC_INTERRUPTED;
+    if (in->deadline && clock_ns() >= in->deadline) return BASIC_TIME_LIMIT;
+    in->steps_left += in->fuel;
+    if (in->steps_left < 0) return BASIC_STEP_LIMIT;
+    due = in->checkpoint_request || (in->checkpoint_every && in->steps_left <= in->checkpoint_at);
+    in->checkpoint_request = 0;
+    while (in->checkpoint_every && in->checkpoint_at >= in->steps_left) in->checkpoint_at -= in->checkpoint_every;
+    in->fuel = in->steps_left < RUN_CHECK_STEPS ? in->steps_left : RUN_CHECK_STEPS;
+    if (in->checkpoint_every && in->steps_left - in->checkpoint_at < in->fuel) in->fuel = in->steps_left - in->checkpoint_at;
+    in->steps_left -= in->fuel;
+    return due ? RUN_CHECKPOINT : BASIC_OK;
+}
+
+static void run_begin(Interp* in) {
+    in->interrupt = 0;
+    in->checkpoint_request = 0;
+    in->stop_line = 0;
+    in->steps_left = in->max_steps > 0 ? in->max_steps : RUN_UNLIMITED;
+    in->checkpoint_at = in->steps_left - in->checkpoint_every;
+    in->deadline = in->max_ms > 0 ? clock_ns() + (unsigned long long)in->max_ms * 1000000ull : 0;
+    in->fuel = 0;
+    run_check(in);
+}
+
+/* "Stopped at line N: reason." for a run that ended with status */
+static void stop_message(const Interp* in, int status, char* buf, size_t size) {
+    static const char* const reasons[] = {
+        "", "step limit", "time limit", "memory limit", "interrupted", "FOR/GOSUB nesting too deep",
+        "out of data"
+    };
+    snprintf(buf, size, "Stopped at line %d: %s.\n", in->stop_line,
+             status > 0 && status <= BASIC_OUT_OF_DATA ? reasons[status] : "error");
+}
+
+/* Taken jump to code offset t from the op before ip. vm_run() keeps
+   in->fuel in a local while it runs. */
+#define VM_GO(t) \
+    if (code + (t) < ip) { \
+        fuel -= pc_line[ip - code] - pc_line[t] + 1; \
+        VM_JIT(t); \
+        if (fuel < 0) { \
+            in->fuel = fuel; \
+            if ((status = run_check(in)) != BASIC_OK) { ip = code + (t); goto stop; } \
+            fuel = in->fuel; \
+        } \
+    } \
+    ip = code + (t)
+
+/* Stop inside the op ending at ip. A resumed run starts that line over,
+   as the operands the op popped are gone. */
+#define VM_FAIL()   do { ip = code + prog->line_pc[pc_line[ip - code - 1]]; goto stop; } while (0)
+
+/*
+ * Dispatch: GCC and Clang thread the VM with computed gotos (one indirect
+ * jump per opcode, each with its own branch history); other compilers,
+ * including MSVC, fall back to a switch in a loop. Build with
+ * -DVM_THREADED=0 to force the switch. The dispatch table is in OP_* order.
+ */
+#ifndef VM_THREADED
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_THREADED 1
+#else
+#define VM_THREADED 0
+#endif
+#endif
+
+#if VM_THREADED
+#define VM_CASE(op)  L_##op:
+#define VM_NEXT      goto *dispatch[*ip++]
+#define VM_LOOP      VM_NEXT;
+#else
+#define VM_CASE(op)  case op:
+#define VM_NEXT      break
+#define VM_LOOP      for (;;) switch (*ip++)
+#endif
+
+static int par_for(Interp* in, int var, int limit, int step, unsigned int sums, int body, int* status);
+
+/* Run the compiled program from code offset pc; returns BASIC_OK at END
+   or why it was stopped, with in->stop_pc where to resume */
+static int vm_run(Interp* in, int pc) {
+#if VM_THREADED
+    static void* const dispatch[] = {
+        &&L_OP_PUSH, &&L_OP_LOAD, &&L_OP_LOADA,
+        &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL, &&L_OP_DIV, &&L_OP_NEG, &&L_OP_SHL,
+        &&L_OP_EQ, &&L_OP_NE, &&L_OP_LT, &&L_OP_GT, &&L_OP_LE, &&L_OP_GE,
+        &&L_OP_STORE, &&L_OP_STOREA, &&L_OP_DIM,
+        &&L_OP_PRINTN, &&L_OP_PRINTS, &&L_OP_PRINTC,
+        &&L_OP_JMP, &&L_OP_JNZ, &&L_OP_GOTO, &&L_OP_IFGOTO, &&L_OP_END,
+        &&L_OP_INCV, &&L_OP_LOADAV, &&L_OP_STOREAV,
+        &&L_OP_JEQVC, &&L_OP_JNEVC, &&L_OP_JLTVC, &&L_OP_JGTVC, &&L_OP_JLEVC, &&L_OP_JGEVC,
+        &&L_OP_JEQVV, &&L_OP_JNEVV, &&L_OP_JLTVV, &&L_OP_JGTVV, &&L_OP_JLEVV, &&L_OP_JGEVV,
+        &&L_OP_LINE,
+        &&L_OP_FOR, &&L_OP_NEXT, &&L_OP_GOSUB, &&L_OP_RETURN,
+        &&L_OP_MAT, &&L_OP_MATSUM, &&L_OP_TRACE,
+        &&L_OP_INPUT, &&L_OP_INPUTA, &&L_OP_READ, &&L_OP_READA, &&L_OP_RESTORE,
+        &&L_OP_PAR, &&L_OP_PEND
+    };
+#endif
+    const Program* prog = in->prog;
+    const int* code = prog->code;
+    const int* pc_line = prog->pc_line;
+    long long fuel = in->fuel;
+    int* vars = in->vars;
+    int** arrays = in->arrays;
+    int* array_sizes = in->array_sizes;
+    int* stack = (int*)malloc((size_t)(prog->stack_max + 1) * sizeof(int));
+    int* sp = stack;
+    const int* ip = code + pc;
+    int a, b, t, status;
+
+    VM_LOOP {
+    VM_CASE(OP_PUSH)  *sp++ = *ip++; VM_NEXT;
+    VM_CASE(OP_LOAD)  *sp++ = vars[*ip++]; VM_NEXT;
+    VM_CASE(OP_LOADA)
+        a = *ip++;
+        b = sp[-1];
+        sp[-1] = (arrays[a] && b >= 0 && b < array_sizes[a]) ? arrays[a][b] : 0;
+        VM_NEXT;
+    VM_CASE(OP_ADD) sp--; sp[-1] += sp[0]; VM_NEXT;
+    VM_CASE(OP_SUB) sp--; sp[-1] -= sp[0]; VM_NEXT;
+    VM_CASE(OP_MUL) sp--; sp[-1] *= sp[0]; VM_NEXT;
+    VM_CASE(OP_DIV)
+        sp--;
+        sp[-1] = (sp[0] != 0) ? sp[-1] / sp[0] : 0;
+        VM_NEXT;
+    VM_CASE(OP_NEG) sp[-1] = -sp[-1]; VM_NEXT;
+    VM_CASE(OP_SHL) sp[-1] = (int)((unsigned int)sp[-1] << *ip++); VM_NEXT;
+    VM_CASE(OP_EQ) sp--; sp[-1] = sp[-1] == sp[0]; VM_NEXT;
+    VM_CASE(OP_NE) sp--; sp[-1] = sp[-1] != sp[0]; VM_NEXT;
+    VM_CASE(OP_LT) sp--; sp[-1] = sp[-1] < sp[0]; VM_NEXT;
+    VM_CASE(OP_GT) sp--; sp[-1] = sp[-1] > sp[0]; VM_NEXT;
+    VM_CASE(OP_LE) sp--; sp[-1] = sp[-1] <= sp[0]; VM_NEXT;
+    VM_CASE(OP_GE) sp--; sp[-1] = sp[-1] >= sp[0]; VM_NEXT;
+    VM_CASE(OP_STORE) vars[*ip++] = *--sp; VM_NEXT;
+    VM_CASE(OP_STOREA)
+        a = *ip++;
+        sp -= 2;
+        b = sp[0];
+        if (arrays[a] && b >= 0 && b < array_sizes[a])
+            arrays[a][b] = sp[1];
+        VM_NEXT;
+    VM_CASE(OP_DIM)
+        a = *ip++;
+        if ((status = dim_array(in, a, *--sp)) != BASIC_OK) VM_FAIL();
+        VM_NEXT;
+    VM_CASE(OP_PRINTN) out_int(in, *--sp); VM_NEXT;
+    VM_CASE(OP_PRINTS)
+        out_str(in, prog->str_pool + ip[0], ip[1]);
+        ip += 2;
+        VM_NEXT;
+    VM_CASE(OP_PRINTC) out_char(in, *ip++); VM_NEXT;
+    VM_CASE(OP_JMP) t = *ip; VM_GO(t); VM_NEXT;
+    VM_CASE(OP_JNZ)
+        if (*--sp) { t = *ip; VM_GO(t); }
+        else ip++;
+        VM_NEXT;
+    VM_CASE(OP_GOTO)
+        t = find_line_pc(prog, *ip++);
+        if (t >= 0) ip = code + t;
+        VM_NEXT;
+    VM_CASE(OP_IFGOTO)
+        t = *ip++;
+        if (*--sp) {
+            t = find_line_pc(prog, t);
+            if (t >= 0) ip = code + t;
+        }
+        VM_NEXT;
+    VM_CASE(OP_END)
+        status = BASIC_OK;
+    stop:
+        free(stack);
+        in->stop_pc = status != BASIC_OK ? (int)(ip - code) : -1;
+        if (status != BASIC_OK) in->stop_line = prog->lines[prog->pc_line[ip - code]].num;
+        return status;
+    VM_CASE(OP_INCV) vars[ip[0]] += ip[1]; ip += 2; VM_NEXT;
+    VM_CASE(OP_LOADAV)
+        a = ip[0];
+        b = vars[ip[1]];
+        ip += 2;
+        *sp++ = (arrays[a] && b >= 0 && b < array_sizes[a]) ? arrays[a][b] : 0;
+        VM_NEXT;
+    VM_CASE(OP_STOREAV)
+        a = ip[0];
+        b = vars[ip[1]];
+        ip += 2;
+        sp--;
+        if (arrays[a] && b >= 0 && b < array_sizes[a])
+            arrays[a][b] = sp[0];
+        VM_NEXT;
+#define VM_JUMP_IF(op, cond) VM_CASE(op) if (cond) { t = ip[2]; VM_GO(t); } else ip += 3; VM_NEXT;
+    VM_JUMP_IF(OP_JEQVC, vars[ip[0]] == ip[1])
+    VM_JUMP_IF(OP_JNEVC, vars[ip[0]] != ip[1])
+    VM_JUMP_IF(OP_JLTVC, vars[ip[0]] < ip[1])
+    VM_JUMP_IF(OP_JGTVC, vars[ip[0]] > ip[1])
+    VM_JUMP_IF(OP_JLEVC, vars[ip[0]] <= ip[1])
+    VM_JUMP_IF(OP_JGEVC, vars[ip[0]] >= ip[1])
+    VM_JUMP_IF(OP_JEQVV, vars[ip[0]] == vars[ip[1]])
+    VM_JUMP_IF(OP_JNEVV, vars[ip[0]] != vars[ip[1]])
+    VM_JUMP_IF(OP_JLTVV, vars[ip[0]] < vars[ip[1]])
+    VM_JUMP_IF(OP_JGTVV, vars[ip[0]] > vars[ip[1]])
+    VM_JUMP_IF(OP_JLEVV, vars[ip[0]] <= vars[ip[1]])
+    VM_JUMP_IF(OP_JGEVV, vars[ip[0]] >= vars[ip[1]])
+#undef VM_JUMP_IF
+    VM_CASE(OP_LINE)
+        if (in->profile) profile_line(in->prof, *ip);     /* else profiled code loaded by CLOAD with PROFILE OFF */
+        ip++;
+        VM_NEXT;
+    VM_CASE(OP_FOR)
+        a = *ip++;
+        sp -= 2;
+        if ((status = ctrl_for(in, a, sp[0], sp[1], (int)(ip - code))) != BASIC_OK) VM_FAIL();
+        VM_NEXT;
+    VM_CASE(OP_NEXT)
+        t = ctrl_next(in, *ip);
+        if (t >= 0) { VM_GO(t); }
+        else ip++;
+        VM_NEXT;
+    VM_CASE(OP_GOSUB)
+        if ((status = ctrl_push(in, -1, 0, 0, (int)(ip - code) + 1)) != BASIC_OK) VM_FAIL();
+        t = *ip;
+        VM_GO(t);
+        VM_NEXT;
+    VM_CASE(OP_RETURN)
+        t = ctrl_return(in);
+        if (t >= 0) { ip--; VM_GO(t); }
+        VM_NEXT;
+    VM_CASE(OP_MAT)
+        b = ip[3] < 0 && ip[2] != MAT_COPY ? *--sp : 0;
+        a = ip[1] < 0 ? *--sp : 0;
+        mat_assign(in, ip[0], ip[1], a, ip[2], ip[3], b);
+        ip += 4;
+        VM_NEXT;
+    VM_CASE(OP_MATSUM) vars[ip[0]] = mat_sum(in, ip[1]); ip += 2; VM_NEXT;
+    VM_CASE(OP_TRACE) trace_line(in, *ip++); VM_NEXT;
+    VM_CASE(OP_INPUT)
+        a = *ip++;
+        if (input_number(in, &b) != 0) { status = BASIC_OUT_OF_DATA; VM_FAIL(); }
+        vars[a] = b;
+        VM_NEXT;
+    VM_CASE(OP_INPUTA)
+        a = *ip++;
+        t = *--sp;
+        if (input_number(in, &b) != 0) { status = BASIC_OUT_OF_DATA; VM_FAIL(); }
+        if (arrays[a] && t >= 0 && t < array_sizes[a]) arrays[a][t] = b;
+        VM_NEXT;
+    VM_CASE(OP_READ)
+        a = *ip++;
+        if (read_data(in, &b) != 0) { status = BASIC_OUT_OF_DATA; VM_FAIL(); }
+        vars[a] = b;
+        VM_NEXT;
+    VM_CASE(OP_READA)
+        a = *ip++;
+        t = *--sp;
+        if (read_data(in, &b) != 0) { status = BASIC_OUT_OF_DATA; VM_FAIL(); }
+        if (arrays[a] && t >= 0 && t < array_sizes[a]) arrays[a][t] = b;
+        VM_NEXT;
+    VM_CASE(OP_RESTORE) in->data_pos = *ip++; VM_NEXT;
+    VM_CASE(OP_PAR)
+        /* the limit and step are on the stack for the OP_FOR v after this */
+        if (ip[0] >= 0 && par_for(in, ip[3], sp[-2], sp[-1], (unsigned int)ip[1], (int)(ip - code) + 4, &status)) {
+            if (status != BASIC_OK) VM_FAIL();
+            sp -= 2;
+            ip = code + ip[0];
+        } else {
+            ip += 2;
+        }
+        VM_NEXT;
+    VM_CASE(OP_PEND)
+        if (in->par_parent && *ip == in->par_line) { status = BASIC_OK; goto stop; }
+        ip++;
+        VM_NEXT;
+    }
+}
+
+/* Threads and the work-stealing pool, for PARALLEL FOR, -batch and -serve */
+#ifdef _WIN32
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+#define mutex_init(m)       InitializeCriticalSection(m)
+#define mutex_lock(m)       EnterCriticalSection(m)
+#define mutex_unlock(m)     LeaveCriticalSection(m)
+#define mutex_destroy(m)    DeleteCriticalSection(m)
+#define thread_start(t, fn, arg)    (*(t) = CreateThread(NULL, 0, fn, arg, 0, NULL))
+#else
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+#define mutex_init(m)       pthread_mutex_init(m, NULL)
+#define mutex_lock(m)       pthread_mutex_lock(m)
+#define mutex_unlock(m)     pthread_mutex_unlock(m)
+#define mutex_destroy(m)    pthread_mutex_destroy(m)
+#define thread_start(t, fn, arg)    pthread_create(t, NULL, fn, arg)
+#endif
+
+static int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+/* Tasks are 0..n-1 and never spawn more, so each worker's deque is just a
+   range [head, tail): the owner takes from the tail, thieves take the
+   front half. A worker that finds every range empty is done. */
+typedef void (*TaskFn)(void* ctx, int task);
+
+typedef struct Pool Pool;
+
+typedef struct {
+    Pool* pool;
+    int id;
+    Mutex lock;
+    int head, tail;
+} PoolWorker;
+
+struct Pool {
+    PoolWorker* workers;
+    int num_workers;
+    TaskFn fn;
+    void* ctx;
+};
+
+static int pool_next(PoolWorker* w) {
+    Pool* pool = w->pool;
+    int task = -1;
+    mutex_lock(&w->lock);
+    if (w->head < w->tail) task = --w->tail;
+    mutex_unlock(&w->lock);
+    for (int k = 1; task < 0 && k < pool->num_workers; k++) {
+        PoolWorker* v = &pool->workers[(w->id + k) % pool->num_workers];
+        int lo = 0, hi = 0;
+        mutex_lock(&v->lock);
+        if (v->head < v->tail) {
+            lo = v->head;
+            hi = lo + (v->tail - v->head + 1) / 2;
+            v->head = hi;
+        }
+        mutex_unlock(&v->lock);
+        if (lo < hi) {
+            mutex_lock(&w->lock);
+            w->head = lo;
+            w->tail = hi - 1;
+            mutex_unlock(&w->lock);
+            task = hi - 1;
+        }
+    }
+    return task;
+}
+
+static void pool_work(PoolWorker* w) {
+    int task;
+    while ((task = pool_next(w)) >= 0) w->pool->fn(w->pool->ctx, task);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI pool_thread(LPVOID arg) { pool_work((PoolWorker*)arg); return 0; }
+#else
+static void* pool_thread(void* arg) { pool_work((PoolWorker*)arg); return NULL; }
+#endif
+
+/* Run fn(ctx, 0..num_tasks-1) on num_threads threads, the caller included */
+static void run_pool(int num_threads, int num_tasks, TaskFn fn, void* ctx) {
+    Pool pool;
+    Thread* threads;
+    if (num_threads > num_tasks) num_threads = num_tasks;
+    if (num_threads < 1) num_threads = 1;
+    pool.workers = (PoolWorker*)calloc((size_t)num_threads, sizeof(PoolWorker));
+    pool.num_workers = num_threads;
+    pool.fn = fn;
+    pool.ctx = ctx;
+    threads = (Thread*)calloc((size_t)num_threads, sizeof(Thread));
+    for (int i = 0; i < num_threads; i++) {
+        PoolWorker* w = &pool.workers[i];
+        w->pool = &pool;
+        w->id = i;
+        w->head = (int)((long long)num_tasks * i / num_threads);
+        w->tail = (int)((long long)num_tasks * (i + 1) / num_threads);
+        mutex_init(&w->lock);
+    }
+    for (int i = 1; i < num_threads; i++) thread_start(&threads[i], pool_thread, &pool.workers[i]);
+    pool_work(&pool.workers[0]);
+    for (int i = 1; i < num_threads; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+    for (int i = 0; i < num_threads; i++) mutex_destroy(&pool.workers[i].lock);
+    free(threads);
+    free(pool.workers);
+}
+
+/*
+ * PARALLEL FOR. When the program is linked, a PARALLEL FOR whose body only
+ * computes and stores (no PRINT, INPUT, READ, DIM, MAT, GOSUB or END), keeps
+ * its jumps and nested loops inside and never sets its own variable gets the
+ * code offset after its NEXT, and OP_PEND goes at that offset; any other
+ * PARALLEL FOR runs as a plain FOR, as do all of them when profiling,
+ * tracing, or with a step limit or periodic checkpoints. The iterations
+ * are split into at most PAR_CHUNKS chunks of consecutive ones, which
+ * worker contexts take in turn on the thread pool. Every chunk starts from
+ * the scalars as they were before the loop and runs the body up to
+ * OP_PEND; the arrays are shared, so iterations must not depend on each
+ * other's elements. Afterwards a scalar the body only adds to (LET S = S +
+ * X(I)) and reads nowhere else gets the sum of the changes of every chunk,
+ * so sums come out as if the loop had run serially; a body that reads a
+ * running sum, as a prefix sum or a test of S does, runs as a plain FOR.
+ * Any other scalar, nested loop variables included, is left as the last
+ * chunk to change it left it, and the loop variable as a serial loop
+ * would. The chunks depend only on the iteration count, so the results do
+ * not depend on the number of threads.
+ */
+#define PAR_CHUNKS  256
+
+static Interp* interp_share(Interp* src);
+
+typedef struct {
+    Interp* in;                 /* the run the loop is part of */
+    int line, var, step, body;  /* FOR line, loop variable, step, code offset after the FOR */
+    long long start, n;         /* first value, iteration count */
+    int num_chunks, next_chunk;
+    Mutex lock;
+    int status;                 /* why a chunk stopped, or BASIC_OK */
+    unsigned int delta[NUM_VARS];   /* total change of each scalar */
+    int changed[NUM_VARS];      /* the last chunk that changed it, or -1 */
+    int last[NUM_VARS];         /* ... and its value after that chunk */
+} ParLoop;
+
+/* One worker: take chunks until none are left or one has stopped */
+static void par_work(void* ctx, int task) {
+    ParLoop* p = (ParLoop*)ctx;
+    Interp* w = interp_share(p->in);
+    unsigned int delta[NUM_VARS];
+    int changed[NUM_VARS], last[NUM_VARS];
+    (void)task;
+    for (int v = 0; v < NUM_VARS; v++) {
+        delta[v] = 0;
+        changed[v] = -1;
+    }
+    w->par_parent = p->in;
+    w->par_line = p->line;
+    memcpy(w->arrays, p->in->arrays, sizeof(w->arrays));
+    memcpy(w->array_sizes, p->in->array_sizes, sizeof(w->array_sizes));
+    run_begin(w);
+    w->deadline = p->in->deadline;
+    jit_begin(w);
+    for (;;) {
+        int k, status;
+        long long lo, hi;
+        mutex_lock(&p->lock);
+        k = p->status == BASIC_OK && p->next_chunk < p->num_chunks ? p->next_chunk++ : -1;
+        mutex_unlock(&p->lock);
+        if (k < 0) break;
+        lo = p->n * k / p->num_chunks;
+        hi = p->n * (k + 1) / p->num_chunks;
+        memcpy(w->vars, p->in->vars, sizeof(w->vars));
+        w->vars[p->var] = (int)(p->start + lo * p->step);
+        w->ctrl_sp = 0;
+        ctrl_push(w, p->var, (int)(p->start + (hi - 1) * p->step), p->step, p->body);
+        if ((status = vm_run(w, p->body)) != BASIC_OK) {
+            mutex_lock(&p->lock);
+            if (p->status == BASIC_OK) p->status = status;
+            mutex_unlock(&p->lock);
+            break;
+        }
+        for (int v = 0; v < NUM_VARS; v++) {
+            if (w->vars[v] == p->in->vars[v]) continue;
+            delta[v] += (unsigned int)w->vars[v] - (unsigned int)p->in->vars[v];
+            if (k > changed[v]) { changed[v] = k; last[v] = w->vars[v]; }
+        }
+    }
+    mutex_lock(&p->lock);
+    for (int v = 0; v < NUM_VARS; v++) {
+        p->delta[v] += delta[v];
+        if (changed[v] > p->changed[v]) { p->changed[v] = changed[v]; p->last[v] = last[v]; }
+    }
+    mutex_unlock(&p->lock);
+    jit_end(w);
+    basic_destroy(w);
+}
+
+/* Run the loop on vars[var], set to its first value, from limit and step,
+   with the body at code offset body, and update the scalars; sums are the
+   variables the body only adds to. Returns 0 if the loop should run
+   serially instead, otherwise 1 with *status how the loop ended. */
+static int par_for(Interp* in, int var, int limit, int step, unsigned int sums, int body, int* status) {
+    ParLoop p;
+    long long start = in->vars[var];
+    int threads = in->par_threads > 0 ? in->par_threads : cpu_count();
+    if (in->par_parent || in->max_steps || in->checkpoint_every || step == 0) return 0;
+    memset(&p, 0, sizeof(p));
+    if (step > 0) p.n = start <= limit ? (limit - start) / step + 1 : 1;
+    else p.n = start >= limit ? (start - limit) / -(long long)step + 1 : 1;
+    p.num_chunks = p.n < PAR_CHUNKS ? (int)p.n : PAR_CHUNKS;
+    if (p.n < 2) return 0;
+    if (threads > p.num_chunks) threads = p.num_chunks;
+    p.in = in;
+    p.line = in->prog->pc_line[body - 1];
+    p.var = var;
+    p.step = step;
+    p.body = body;
+    p.start = start;
+    p.status = BASIC_OK;
+    for (int v = 0; v < NUM_VARS; v++) p.changed[v] = -1;
+    mutex_init(&p.lock);
+    run_pool(threads, threads, par_work, &p);
+    mutex_destroy(&p.lock);
+    *status = p.status;
+    if (p.status != BASIC_OK) return 1;
+    for (int v = 0; v < NUM_VARS; v++) {
+        if (v == var) in->vars[v] = (int)(unsigned int)(start + p.n * step);
+        else if (sums >> v & 1) in->vars[v] = (int)((unsigned int)in->vars[v] + p.delta[v]);
+        else if (p.changed[v] >= 0) in->vars[v] = p.last[v];
+    }
+    return 1;
+}
+
+/* Stable merge sort of lines[0..n) by line number, using tmp[0..n) */
+static void merge_sort_lines(Line* lines, Line* tmp, int n) {
+    if (n < 2) return;
+    int h = n / 2, i = 0, j = h, k = 0;
+    merge_sort_lines(lines, tmp, h);
+    merge_sort_lines(lines + h, tmp, n - h);
+    if (lines[h - 1].num <= lines[h].num) return;
+    while (i < h && j < n) tmp[k++] = (lines[j].num < lines[i].num) ? lines[j++] : lines[i++];
+    while (i < h) tmp[k++] = lines[i++];
+    memcpy(lines, tmp, (size_t)k * sizeof(Line));
+}
+
+/* Sort program lines by line number once after a bulk load. Input that is
+   already in order is left alone; when a number repeats, the last line
+   read wins, as if the lines had been typed in. */
+static void sort_program(Program* prog) {
+    int n = 0;
+    for (int i = 1; i < prog->num_lines; i++) {
+        if (prog->lines[i].num <= prog->lines[i - 1].num) {
+            Line* tmp = (Line*)malloc((size_t)prog->num_lines * sizeof(Line));
+            merge_sort_lines(prog->lines, tmp, prog->num_lines);
+            free(tmp);
+            break;
+        }
+    }
+    for (int i = 0; i < prog->num_lines; i++) {
+        if (i + 1 < prog->num_lines && prog->lines[i + 1].num == prog->lines[i].num) continue;
+        prog->lines[n++] = prog->lines[i];
+    }
+    prog->num_lines = n;
+}
+
+/* Position of line number num in program[]: its index if present (*found
+   set), otherwise the index it would be inserted at */
+static int line_slot(Program* prog, int num, int* found) {
+    int lo = 0, hi = prog->num_lines;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (prog->lines[mid].num < num) lo = mid + 1;
+        else hi = mid;
+    }
+    *found = lo < prog->num_lines && prog->lines[lo].num == num;
+    return lo;
+}
+
+/* Add or replace a line by number */
+static void add_line(Program* prog, int num, const char* text) {
+    int found;
+    int i = line_slot(prog, num, &found);
+    if (!found) {
+        grow_program(prog);
+        memmove(&prog->lines[i + 1], &prog->lines[i], (size_t)(prog->num_lines - i) * sizeof(Line));
+        prog->num_lines++;
+    }
+    store_line(prog, &prog->lines[i], num, text, strlen(text));
+    prog->code_valid = 0;
+}
+
+static void delete_line(Program* prog, int num) {
+    int found;
+    int i = line_slot(prog, num, &found);
+    if (!found) return;
+    memmove(&prog->lines[i], &prog->lines[i + 1], (size_t)(prog->num_lines - i - 1) * sizeof(Line));
+    prog->num_lines--;
+    prog->code_valid = 0;
+}
+
+/* Drop the program and everything compiled from it */
+static void clear_program(Program* prog) {
+    prog->num_lines = 0;
+    arena_reset(&prog->line_arena);
+    arena_reset(&prog->code_arena);
+    prog->code = NULL;
+    prog->line_pc = NULL;
+    prog->loops = NULL;
+    prog->line_loop = NULL;
+    prog->num_loops = 0;
+    prog->data = NULL;
+    prog->data_len = 0;
+    prog->line_data = NULL;
+    prog->code_valid = 0;
+    clear_strings(prog);
+}
+
+static void init_vars(Interp* in) {
+    for (int i = 0; i < NUM_VARS; i++) {
+        in->vars[i] = 0;
+        in->arrays[i] = NULL;       /* the block stays for the next DIM */
+        in->array_sizes[i] = 0;
+    }
+    in->array_bytes = 0;
+    in->ctrl_sp = 0;
+    in->data_pos = 0;
+}
+
+static int checkpoint_save(const Interp* in, const char* filename);
+
+/* Save the run's state to checkpoint_file, if there is one */
+static void checkpoint_auto(Interp* in) {
+    if (in->checkpoint_file && checkpoint_save(in, in->checkpoint_file) != 0)
+        fprintf(stderr, "Cannot create file: %s\n", in->checkpoint_file);
+}
+
+/* Recompute the hoisted values of the loops around code offset pc for a
+   run going on there, as the variables may have been changed since it
+   stopped. A preheader is only expressions, each stored to a temp. */
+static void refresh_hoisted(Interp* in, int pc) {
+    const Program* prog = in->prog;
+    int* stack = NULL;
+    for (int k = 0; k < prog->num_loops; k++) {
+        const Loop* L = &prog->loops[k];
+        int* sp;
+        if (pc < L->body || pc >= L->end || L->body == L->pre) continue;
+        if (!stack) stack = (int*)malloc((size_t)(prog->stack_max + 1) * sizeof(int));
+        sp = stack;
+        for (int at = L->pre; at < L->body; at += op_len[prog->code[at]]) {
+            const int* ip = prog->code + at;
+            int a, b;
+            switch (ip[0]) {
+            case OP_PUSH: *sp++ = ip[1]; continue;
+            case OP_LOAD: *sp++ = in->vars[ip[1]]; continue;
+            case OP_LOADAV: *sp++ = in->vars[ip[2]]; /* fall through */
+            case OP_LOADA:
+                a = ip[1];
+                b = sp[-1];
+                sp[-1] = (in->arrays[a] && b >= 0 && b < in->array_sizes[a]) ? in->arrays[a][b] : 0;
+                continue;
+            case OP_NEG: sp[-1] = wrap_mul(sp[-1], -1); continue;
+            case OP_SHL: sp[-1] = (int)((unsigned int)sp[-1] << ip[1]); continue;
+            case OP_STORE: in->vars[ip[1]] = *--sp; continue;
+            }
+            b = *--sp;
+            a = sp[-1];
+            switch (ip[0]) {
+            case OP_ADD: sp[-1] = wrap_add(a, b); break;
+            case OP_SUB: sp[-1] = wrap_add(a, wrap_mul(b, -1)); break;
+            case OP_MUL: sp[-1] = wrap_mul(a, b); break;
+            case OP_DIV: sp[-1] = b ? a / b : 0; break;
+            case OP_EQ: sp[-1] = a == b; break;
+            case OP_NE: sp[-1] = a != b; break;
+            case OP_LT: sp[-1] = a < b; break;
+            case OP_GT: sp[-1] = a > b; break;
+            case OP_LE: sp[-1] = a <= b; break;
+            case OP_GE: sp[-1] = a >= b; break;
+            }
+        }
+    }
+    free(stack);
+}
+
+/* Run the compiled program from code offset pc with the current variables */
+static int run_compiled(Interp* in, int pc) {
+    int status;
+    refresh_hoisted(in, pc);
+    in->run_mode = 1;
+    run_begin(in);
+    if (in->profile) profile_begin(in);
+    if (in->trace) trace_begin(in);
+    jit_begin(in);
+    while ((status = vm_run(in, pc)) == RUN_CHECKPOINT) {
+        out_flush(in);
+        checkpoint_auto(in);
+        pc = in->stop_pc;
+    }
+    jit_end(in);
+    if (status != BASIC_OK) checkpoint_auto(in);
+    if (in->trace) trace_end(in);
+    if (in->profile) profile_report(in);
+    out_flush(in);
+    in->run_mode = 0;
+    return status;
+}
+
+int basic_run(Interp* in) {
+    if (in->prog->num_lines == 0) return BASIC_NO_PROGRAM;
+    init_vars(in);
+    if (!in->prog->code_valid) compile_program(in);
+    return run_compiled(in, 0);
+}
+
+/* Tell the user why a RUN or RESUME stopped */
+static void report_run(Interp* in, int status) {
+    char msg[64];
+    if (status == BASIC_NO_PROGRAM) printf("No program.\n");
+    else if (status != BASIC_OK) {
+        stop_message(in, status, msg, sizeof(msg));
+        fputs(msg, stdout);
+    }
+}
+
+static void do_run(Interp* in) {
+    report_run(in, basic_run(in));
+}
+
+static void do_list(Program* prog) {
+    for (int i = 0; i < prog->num_lines; i++) {
+        printf("%d ", prog->lines[i].num);
+        detokenize(prog, write_file, stdout, prog->lines[i].tok);
+        putchar('\n');
+    }
+}
+
+static void do_new(Program* prog) {
+    clear_program(prog);
+    printf("Program cleared.\n");
+}
+
+/* Read a whole file into one NUL-terminated buffer; NULL if it cannot be opened */
+static char* read_file(const char* filename, size_t* size) {
+    FILE* f = fopen(filename, "rb");
+    char* data;
+    size_t len = 0, cap;
+    long n;
+    if (!f) return NULL;
+    cap = (fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) > 0) ? (size_t)n + 1 : 65536;
+    rewind(f);
+    data = (char*)malloc(cap);
+    for (;;) {
+        len += fread(data + len, 1, cap - 1 - len, f);
+        if (len < cap - 1 || feof(f)) break;
+        cap *= 2;
+        data = (char*)realloc(data, cap);
+    }
+    fclose(f);
+    data[len] = '\0';
+    *size = len;
+    return data;
+}
+
+/*
+ * LOAD reads the file in one go and splits it in place: each line gets a
+ * NUL where its newline (or CR LF) was, its number is parsed by hand, and
+ * the statement is tokenized straight into the program store. Lines not
+ * starting with a number are ignored. data[size] must be writable.
+ */
+static void load_text(Program* prog, char* data, size_t size) {
+    char *p, *end;
+    int lines = 1;
+    clear_program(prog);
+    end = data + size;
+    for (p = data; (p = (char*)memchr(p, '\n', (size_t)(end - p))) != NULL; p++) lines++;
+    while (prog->lines_cap < lines) {
+        prog->lines_cap = prog->lines_cap ? prog->lines_cap * 2 : 64;
+        prog->lines = (Line*)realloc(prog->lines, (size_t)prog->lines_cap * sizeof(Line));
+    }
+    for (p = data; p < end; ) {
+        char* eol = (char*)memchr(p, '\n', (size_t)(end - p));
+        char* next;
+        if (!eol) eol = end;
+        next = eol < end ? eol + 1 : end;
+        if (eol > p && eol[-1] == '\r') eol--;
+        *eol = '\0';
+        while (*p == ' ' || *p == '\t') p++;
+        int neg = (*p == '-');
+        if (*p == '-' || *p == '+') p++;
+        if (isdigit((unsigned char)*p)) {
+            unsigned int num = 0;
+            while (isdigit((unsigned char)*p)) num = num * 10 + (unsigned int)(*p++ - '0');
+            while (*p == ' ' || *p == '\t') p++;
+            store_line(prog, &prog->lines[prog->num_lines], (int)(neg ? 0u - num : num), p, (size_t)(eol - p));
+            prog->num_lines++;
+        }
+        p = next;
+    }
+    sort_program(prog);
+}
+
+static int do_load(Program* prog, const char* filename) {
+    size_t size;
+    char* data = read_file(filename, &size);
+    if (!data) {
+        printf("Cannot open file: %s\n", filename);
+        return -1;
+    }
+    load_text(prog, data, size);
+    free(data);
+    printf("Loaded %s\n", filename);
+    return 0;
+}
+
+static void do_save(Program* prog, const char* filename) {
+    FILE* f = fopen(filename, "w");
+    if (!f) {
+        printf("Cannot create file: %s\n", filename);
+        return;
+    }
+    for (int i = 0; i < prog->num_lines; i++) {
+        fprintf(f, "%d ", prog->lines[i].num);
+        detokenize(prog, write_file, f, prog->lines[i].tok);
+        putc('\n', f);
+    }
+    fclose(f);
+    printf("Saved %s\n", filename);
+}
+
+/*
+ * Compiled program image (CSAVE/CLOAD): the tokenized lines, string pool,
+ * line offset table and resolved bytecode, so CLOAD is one read plus
+ * copies. All fields are little-endian 32-bit words; byte sections are
+ * padded to a word. Bump IMAGE_VERSION whenever the token encoding or the
+ * opcode set changes.
+ *
+ *   "TBASICIM" version optimize num_lines num_strs str_len code_len stack_max
+ *   num_loops data_len
+ *   num_lines x { num, len }  token bytes (len + 1 per line)
+ *   num_strs x { off, len }   string pool bytes
+ *   num_lines x line_pc       code_len x code
+ *   num_loops x { pre, body, end }
+ *   num_lines x line_data     data_len x DATA value
+ */
+#define IMAGE_MAGIC     "TBASICIM"
+#define IMAGE_VERSION   7
+
+static void put_word(FILE* f, int v) {
+    unsigned char b[4];
+    put_int(b, v);
+    fwrite(b, 1, 4, f);
+}
+
+/* Zero-fill after n bytes so the next field starts on a word */
+static void put_pad(FILE* f, size_t n) {
+    static const char zeros[4] = { 0, 0, 0, 0 };
+    fwrite(zeros, 1, (4 - n % 4) % 4, f);
+}
+
+static void do_csave(Interp* in, const char* filename) {
+    Program* prog = in->prog;
+    FILE* f;
+    size_t tok_bytes = 0;
+    if (prog->num_lines == 0) {
+        printf("No program.\n");
+        return;
+    }
+    if (!prog->code_valid) compile_program(in);
+    f = fopen(filename, "wb");
+    if (!f) {
+        printf("Cannot create file: %s\n", filename);
+        return;
+    }
+    fwrite(IMAGE_MAGIC, 1, 8, f);
+    put_word(f, IMAGE_VERSION);
+    put_word(f, in->optimize);
+    put_word(f, prog->num_lines);
+    put_word(f, prog->num_strs);
+    put_word(f, prog->str_len);
+    put_word(f, prog->code_len);
+    put_word(f, prog->stack_max);
+    put_word(f, prog->num_loops);
+    put_word(f, prog->data_len);
+    for (int i = 0; i < prog->num_lines; i++) {
+        put_word(f, prog->lines[i].num);
+        put_word(f, prog->lines[i].len);
+        tok_bytes += (size_t)prog->lines[i].len + 1;
+    }
+    for (int i = 0; i < prog->num_lines; i++) fwrite(prog->lines[i].tok, 1, (size_t)prog->lines[i].len + 1, f);
+    put_pad(f, tok_bytes);
+    for (int i = 0; i < prog->num_strs; i++) {
+        put_word(f, prog->strs[i].off);
+        put_word(f, prog->strs[i].len);
+    }
+    fwrite(prog->str_pool, 1, (size_t)prog->str_len, f);
+    put_pad(f, (size_t)prog->str_len);
+    for (int i = 0; i < prog->num_lines; i++) put_word(f, prog->line_pc[i]);
+    for (int i = 0; i < prog->code_len; i++) put_word(f, prog->code[i]);
+    for (int i = 0; i < prog->num_loops; i++) {
+        put_word(f, prog->loops[i].pre);
+        put_word(f, prog->loops[i].body);
+        put_word(f, prog->loops[i].end);
+    }
+    for (int i = 0; i < prog->num_lines; i++) put_word(f, prog->line_data[i]);
+    for (int i = 0; i < prog->data_len; i++) put_word(f, prog->data[i]);
+    fclose(f);
+    printf("Saved %s\n", filename);
+}
+
+/* Bounds-checked reader over an image buffer */
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    int bad;
+} ImageReader;
+
+static const unsigned char* image_take(ImageReader* r, size_t n) {
+    const unsigned char* p = r->p;
+    if (r->bad || (size_t)(r->end - r->p) < n) { r->bad = 1; return NULL; }
+    r->p += n;
+    return p;
+}
+
+static int image_word(ImageReader* r) {
+    const unsigned char* p = image_take(r, 4);
+    return p ? get_int(p) : 0;
+}
+
+/* Values op at ip pops (need) and pushes minus pops (net) */
+static void image_op_stack(const int* ip, int* need, int* net) {
+    switch (ip[0]) {
+    case OP_PUSH: case OP_LOAD: case OP_LOADAV: *need = 0; *net = 1; break;
+    case OP_LOADA: case OP_NEG: case OP_SHL: *need = 1; *net = 0; break;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+    case OP_EQ: case OP_NE: case OP_LT: case OP_GT: case OP_LE: case OP_GE: *need = 2; *net = -1; break;
+    case OP_STORE: case OP_STOREAV: case OP_DIM: case OP_PRINTN: case OP_JNZ: case OP_IFGOTO:
+    case OP_INPUTA: case OP_READA: *need = 1; *net = -1; break;
+    case OP_STOREA: case OP_FOR: *need = 2; *net = -2; break;
+    case OP_PAR: *need = 2; *net = 0; break;
+    case OP_MAT: *need = (ip[4] < 0 && ip[3] != MAT_COPY) + (ip[2] < 0); *net = -*need; break;
+    default: *need = *net = 0; break;
+    }
+}
+
+/* Can the VM run the image's linked code? Every op must be known and
+   inside the code, which ends with OP_END; jumps, line_pc (in order) and
+   the loops must land on ops; variables, lines, strings and DATA offsets
+   must exist. A loop's preheader holds only what refresh_hoisted() can
+   replay: expressions, each stored to a temp. As compiled, the value stack is empty wherever control can
+   enter other than by falling through and wherever it leaves, and never
+   goes deeper than stack_max. */
+static int image_code_ok(const Program* prog, int lines, int nloops) {
+    const int* c = prog->code;
+    const unsigned int vars = NUM_VARS + NUM_TEMPS, n = (unsigned int)prog->code_len;
+    int ok = 1, last = -1, depth = 0;
+    char* op_at = (char*)calloc((size_t)n + 1, 1);     /* 1: an op starts here, 2: ... that control may enter */
+    for (int at = 0; at < (int)n; at += op_len[c[at]]) {
+        if (c[at] < 0 || c[at] >= OP_COUNT || op_len[c[at]] > (int)n - at) { ok = 0; break; }
+        op_at[at] = 1;
+        last = at;
+    }
+    if (ok) ok = c[last] == OP_END;
+    for (int at = 0; at < (int)n && ok; at += op_len[c[at]]) {
+        const int* ip = c + at;
+        int t = -1;
+        switch (ip[0]) {
+        case OP_LOAD: case OP_STORE: case OP_INCV: ok = (unsigned int)ip[1] < vars; break;
+        case OP_SHL: ok = (unsigned int)ip[1] < 32; break;
+        case OP_LOADA: case OP_STOREA: case OP_DIM: case OP_INPUTA: case OP_READA:
+        case OP_FOR: case OP_INPUT: case OP_READ:
+            ok = (unsigned int)ip[1] < NUM_VARS;
+            break;
+        case OP_LOADAV: case OP_STOREAV: ok = (unsigned int)ip[1] < NUM_VARS && (unsigned int)ip[2] < vars; break;
+        case OP_NEXT: ok = ip[1] >= -1 && ip[1] < NUM_VARS; break;
+        case OP_MATSUM: ok = (unsigned int)ip[1] < NUM_VARS && (unsigned int)ip[2] < NUM_VARS; break;
+        case OP_MAT:
+            ok = (unsigned int)ip[1] < NUM_VARS && ip[2] >= -1 && ip[2] < NUM_VARS
+                && (unsigned int)ip[3] <= MAT_RSUB && ip[4] >= -1 && ip[4] < NUM_VARS;
+            break;
+        case OP_PRINTS: ok = ip[1] >= 0 && ip[2] >= 0 && ip[2] <= prog->str_len - ip[1]; break;
+        case OP_JMP: case OP_JNZ: case OP_GOSUB: t = ip[1]; ok = (unsigned int)t < n; break;
+        case OP_LINE: case OP_TRACE: case OP_PEND: ok = (unsigned int)ip[1] < (unsigned int)lines; break;
+        case OP_RESTORE: ok = (unsigned int)ip[1] <= (unsigned int)prog->data_len; break;
+        case OP_PAR:
+            t = ip[1];
+            ok = (t == -1 || (unsigned int)t < n) && ip[3] == OP_FOR;
+            break;
+        default:
+            if (ip[0] >= OP_JEQVC && ip[0] <= OP_JGEVV) {
+                t = ip[3];
+                ok = (unsigned int)ip[1] < vars && (ip[0] < OP_JEQVV || (unsigned int)ip[2] < vars) && (unsigned int)t < n;
+            }
+            break;
+        }
+        if (ok && t >= 0) {
+            ok = op_at[t] != 0;
+            op_at[t] = 2;
+        }
+        if (ok && (ip[0] == OP_FOR || ip[0] == OP_GOSUB)) op_at[at + op_len[ip[0]]] = 2;  /* where NEXT and RETURN go */
+    }
+    for (int i = 0; i < lines && ok; i++) {
+        ok = op_at[prog->line_pc[i]] != 0 && (i == 0 || prog->line_pc[i] >= prog->line_pc[i - 1]);
+        op_at[prog->line_pc[i]] = 2;
+    }
+    for (int i = 0; i < nloops && ok; i++) {
+        const Loop* L = &prog->loops[i];
+        ok = L->pre <= L->body && L->body < L->end && op_at[L->pre] && op_at[L->body] && op_at[L->end];
+        for (int at = L->pre; at < L->body && ok; at += op_len[c[at]]) {
+            switch (c[at]) {
+            case OP_PUSH: case OP_LOAD: case OP_LOADA: case OP_LOADAV: case OP_NEG: case OP_SHL:
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+            case OP_EQ: case OP_NE: case OP_LT: case OP_GT: case OP_LE: case OP_GE:
+                break;
+            case OP_STORE: ok = c[at + 1] >= NUM_VARS; break;
+            default: ok = 0; break;
+            }
+        }
+        op_at[L->pre] = op_at[L->body] = 2;
+    }
+    for (int at = 0; at < (int)n && ok; at += op_len[c[at]]) {
+        int op = c[at], need, net;
+        image_op_stack(c + at, &need, &net);
+        if ((op_at[at] == 2 && depth != 0) || depth < need || depth + net > prog->stack_max) ok = 0;
+        depth += net;
+        if (op == OP_PAR && c[at + 1] >= 0 && depth != 2) ok = 0;
+        if ((op == OP_JMP || op == OP_JNZ || op == OP_GOTO || op == OP_IFGOTO || op == OP_GOSUB || op == OP_RETURN
+             || op == OP_NEXT || op == OP_FOR || op == OP_END || (op >= OP_JEQVC && op <= OP_JGEVV)) && depth != 0)
+            ok = 0;
+    }
+    free(op_at);
+    return ok;
+}
+
+static int do_cload(Interp* in, const char* filename) {
+    Program* prog = in->prog;
+    size_t size;
+    char* data = read_file(filename, &size);
+    ImageReader r;
+    const unsigned char* bytes;
+    size_t tok_bytes = 0;
+    int version, opt, lines, nstr, slen, clen, smax, nloops, ndata;
+    if (!data) {
+        printf("Cannot open file: %s\n", filename);
+        return -1;
+    }
+    r.p = (const unsigned char*)data;
+    r.end = r.p + size;
+    r.bad = 0;
+    bytes = image_take(&r, 8);
+    if (!bytes || memcmp(bytes, IMAGE_MAGIC, 8) != 0) {
+        printf("Not a compiled program: %s\n", filename);
+        free(data);
+        return -1;
+    }
+    version = image_word(&r);
+    if (version != IMAGE_VERSION) {
+        printf("Unsupported image version %d: %s\n", version, filename);
+        free(data);
+        return -1;
+    }
+    opt = image_word(&r);
+    lines = image_word(&r);
+    nstr = image_word(&r);
+    slen = image_word(&r);
+    clen = image_word(&r);
+    smax = image_word(&r);
+    nloops = image_word(&r);
+    ndata = image_word(&r);
+    if (lines < 0 || nstr < 0 || slen < 0 || clen < 1 || smax < 0 || smax > clen || nloops < 0 || ndata < 0
+        || (size_t)lines > size / 8 || (size_t)nstr > size / 8 || (size_t)slen > size || (size_t)clen > size / 4
+        || (size_t)nloops > size / 12 || (size_t)ndata > size / 4)
+        r.bad = 1;
+
+    clear_program(prog);
+    while (!r.bad && prog->lines_cap < lines) {
+        prog->lines_cap = prog->lines_cap ? prog->lines_cap * 2 : 64;
+        prog->lines = (Line*)realloc(prog->lines, (size_t)prog->lines_cap * sizeof(Line));
+    }
+    for (int i = 0; i < lines && !r.bad; i++) {
+        prog->lines[i].num = image_word(&r);
+        prog->lines[i].len = image_word(&r);
+        prog->lines[i].code = NULL;
+        prog->lines[i].unreachable = 0;
+        prog->lines[i].data = NULL;
+        prog->lines[i].data_len = 0;
+        if (prog->lines[i].len < 0 || (size_t)prog->lines[i].len >= size) r.bad = 1;
+        else tok_bytes += (size_t)prog->lines[i].len + 1;
+    }
+    for (int i = 0; i < lines && !r.bad; i++) {
+        size_t n = (size_t)prog->lines[i].len + 1;
+        const unsigned char* t = image_take(&r, n);
+        if (!t || t[n - 1] != 0) { r.bad = 1; break; }
+        prog->lines[i].tok = (unsigned char*)arena_alloc(&prog->line_arena, n);
+        memcpy(prog->lines[i].tok, t, n);
+    }
+    image_take(&r, (4 - tok_bytes % 4) % 4);
+    if (!r.bad) {
+        prog->num_strs = 0;
+        if (prog->strs_cap < nstr) {
+            prog->strs_cap = nstr;
+            prog->strs = (StrRef*)realloc(prog->strs, (size_t)prog->strs_cap * sizeof(StrRef));
+        }
+        for (int i = 0; i < nstr; i++) {
+            prog->strs[i].off = image_word(&r);
+            prog->strs[i].len = image_word(&r);
+            if (prog->strs[i].off < 0 || prog->strs[i].len < 0 || prog->strs[i].len > slen - prog->strs[i].off) r.bad = 1;
+        }
+        bytes = image_take(&r, (size_t)slen);
+        image_take(&r, (4 - (size_t)slen % 4) % 4);
+    }
+    if (!r.bad) {
+        if (prog->str_cap < slen) {
+            prog->str_cap = slen;
+            prog->str_pool = (char*)realloc(prog->str_pool, (size_t)prog->str_cap);
+        }
+        memcpy(prog->str_pool, bytes, (size_t)slen);
+        prog->str_len = slen;
+        prog->num_strs = nstr;
+        prog->line_pc = (int*)arena_alloc(&prog->code_arena, (size_t)(lines + 1) * sizeof(int));
+        for (int i = 0; i < lines; i++) {
+            prog->line_pc[i] = image_word(&r);
+            if (prog->line_pc[i] < 0 || prog->line_pc[i] >= clen) r.bad = 1;
+        }
+        prog->code = (int*)arena_alloc(&prog->code_arena, (size_t)clen * sizeof(int));
+        for (int i = 0; i < clen; i++) prog->code[i] = image_word(&r);
+        prog->loops = (Loop*)arena_alloc(&prog->code_arena, (size_t)(nloops + 1) * sizeof(Loop));
+        for (int i = 0; i < nloops; i++) {
+            Loop* L = &prog->loops[i];
+            L->pre = image_word(&r);
+            L->body = image_word(&r);
+            L->end = image_word(&r);
+            if (L->pre < 0 || L->body < L->pre || L->end < L->body || L->end >= clen) r.bad = 1;
+        }
+        prog->line_data = (int*)arena_alloc(&prog->code_arena, (size_t)(lines + 1) * sizeof(int));
+        for (int i = 0; i < lines; i++) {
+            prog->line_data[i] = image_word(&r);
+            if (prog->line_data[i] < (i ? prog->line_data[i - 1] : 0) || prog->line_data[i] > ndata) r.bad = 1;
+        }
+        prog->line_data[lines] = ndata;
+        prog->data = (int*)arena_alloc(&prog->code_arena, (size_t)(ndata + 1) * sizeof(int));
+        for (int i = 0; i < ndata; i++) prog->data[i] = image_word(&r);
+        prog->code_len = clen;
+        prog->str_len = slen;
+        prog->data_len = ndata;
+        prog->stack_max = smax;
+        if (!r.bad && !image_code_ok(prog, lines, nloops)) r.bad = 1;
+    }
+    free(data);
+    if (r.bad) {
+        clear_program(prog);
+        printf("Corrupt image: %s\n", filename);
+        return -1;
+    }
+    prog->num_lines = lines;
+    rebuild_string_hash(prog);
+    prog->num_loops = nloops;
+    map_code_lines(prog);
+    in->optimize = opt;
+    prog->code_valid = 1;
+    in->stop_pc = -1;
+    printf("Loaded %s\n", filename);
+    return 0;
+}
+
+/*
+ * C translation (COMPILE, -compile): the program as one standalone C file
+ * to build with cc or cl. Each line's compiled statement is replayed into
+ * C expressions; lines become labels, variables become locals, and GOTO,
+ * IF and the fused branches become gotos. FOR and GOSUB frames hold the
+ * index of the line to continue at, which a switch dispatches where NEXT
+ * cannot know it statically. Arrays, division, MAT, INPUT and DATA follow
+ * the VM, and a stopped run prints what run_file() would. Run limits are
+ * not translated, and PARALLEL FOR becomes a plain FOR.
+ */
+enum { C_ARRAYS = 1, C_MAT = 2, C_CTRL = 4, C_FOR = 8, C_NEXT = 16, C_DISPATCH = 32, C_INPUT = 64, C_DATA = 128 };
+
+static const char c_runtime[] =
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "/* Arithmetic wraps, and dividing by 0 gives 0 */\n"
+    "static inline int add(int a, int b) { return (int)((unsigned int)a + (unsigned int)b); }\n"
+    "static inline int sub(int a, int b) { return (int)((unsigned int)a - (unsigned int)b); }\n"
+    "static inline int mul(int a, int b) { return (int)((unsigned int)a * (unsigned int)b); }\n"
+    "static inline int neg(int a) { return (int)(0u - (unsigned int)a); }\n"
+    "static inline int shl(int a, int k) { return (int)((unsigned int)a << k); }\n"
+    "static inline int quo(int a, int b) { return b == 0 ? 0 : b == -1 ? neg(a) : a / b; }\n"
+    "\n"
+    "static char out_buf[65536];\n"
+    "static int out_len;\n"
+    "\n"
+    "static void out_flush(void) {\n"
+    "    fwrite(out_buf, 1, (size_t)out_len, stdout);\n"
+    "    fflush(stdout);\n"
+    "    out_len = 0;\n"
+    "}\n"
+    "\n"
+    "static inline void out_str(const char* s, int len) {\n"
+    "    if (out_len + len > (int)sizeof(out_buf)) {\n"
+    "        out_flush();\n"
+    "        if (len > (int)sizeof(out_buf)) { fwrite(s, 1, (size_t)len, stdout); return; }\n"
+    "    }\n"
+    "    memcpy(out_buf + out_len, s, (size_t)len);\n"
+    "    out_len += len;\n"
+    "}\n"
+    "\n"
+    "static inline void out_char(int c) {\n"
+    "    if (out_len == (int)sizeof(out_buf)) out_flush();\n"
+    "    out_buf[out_len++] = (char)c;\n"
+    "}\n"
+    "\n"
+    "static inline void out_int(int v) {\n"
+    "    char tmp[12];\n"
+    "    char* p = tmp + sizeof(tmp);\n"
+    "    unsigned int u = v < 0 ? 0u - (unsigned int)v : (unsigned int)v;\n"
+    "    do { *--p = (char)('0' + u % 10); u /= 10; } while (u);\n"
+    "    if (v < 0) *--p = '-';\n"
+    "    out_str(p, (int)(tmp + sizeof(tmp) - p));\n"
+    "}\n"
+    "\n"
+    "static inline void stop(int line, const char* reason) {\n"
+    "    out_flush();\n"
+    "    fprintf(stderr, \"Stopped at line %d: %s.\\n\", line, reason);\n"
+    "    exit(1);\n"
+    "}\n";
+
+static const char c_runtime_arrays[] =
+    "\n"
+    "/* Out of range reads give 0 and writes are dropped */\n"
+    "static int* array[26];\n"
+    "static int array_size[26];\n"
+    "\n"
+    "static inline int ld(int a, int i) { return i >= 0 && i < array_size[a] ? array[a][i] : 0; }\n"
+    "static inline void st(int a, int i, int v) { if (i >= 0 && i < array_size[a]) array[a][i] = v; }\n"
+    "\n"
+    "static inline void dim(int line, int a, int n) {\n"
+    "    if (n <= 0) return;\n"
+    "    free(array[a]);\n"
+    "    array_size[a] = 0;\n"
+    "    if (!(array[a] = (int*)calloc((size_t)n, sizeof(int)))) stop(line, \"memory limit\");\n"
+    "    array_size[a] = n;\n"
+    "}\n";
+
+static const char c_runtime_mat[] =
+    "\n"
+    "/* MAT d = x op y (op: 0 copy, 1 +, 2 -, 3 *); x, y < 0 for the scalars xk, yk.\n"
+    "   Each element is LET D(I) = X(I) op Y(I), first where the sources cover d. */\n"
+    "#define MAT_LOOP(e) for (; i < m; i++) { int u = a ? a[i] : xk, v = b ? b[i] : yk; r[i] = e; }\n"
+    "\n"
+    "static void mat(int d, int x, int xk, int op, int y, int yk) {\n"
+    "    int* r = array[d];\n"
+    "    const int* a = x < 0 ? NULL : array[x];\n"
+    "    const int* b = y < 0 || op == 0 ? NULL : array[y];\n"
+    "    int n = array_size[d], m = n, i = 0;\n"
+    "    if (x >= 0 && array_size[x] < m) m = array_size[x];\n"
+    "    if (b && array_size[y] < m) m = array_size[y];\n"
+    "    if (op == 0) yk = 0;\n"
+    "    switch (op) {\n"
+    "    case 1: MAT_LOOP(add(u, v)) break;\n"
+    "    case 2: MAT_LOOP(sub(u, v)) break;\n"
+    "    case 3: MAT_LOOP(mul(u, v)) break;\n"
+    "    default: for (; i < m; i++) r[i] = a ? a[i] : xk; break;\n"
+    "    }\n"
+    "    for (; i < n; i++) {\n"
+    "        int u = x < 0 ? xk : ld(x, i), v = op == 0 ? 0 : y < 0 ? yk : ld(y, i);\n"
+    "        r[i] = op == 1 ? add(u, v) : op == 2 ? sub(u, v) : op == 3 ? mul(u, v) : u;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline int mat_sum(int a) {\n"
+    "    unsigned int s = 0;\n"
+    "    for (int i = 0; i < array_size[a]; i++) s += (unsigned int)array[a][i];\n"
+    "    return (int)s;\n"
+    "}\n"
+    "\n";
+
+static const char c_runtime_ctrl[] =
+    "\n"
+    "/* FOR and GOSUB frames; pc is the index of the line to continue at */\n"
+    "static struct { int var, limit, step, pc; } ctrl[1024];\n"
+    "static int ctrl_sp;\n"
+    "\n"
+    "static inline int find_for(int var) {\n"
+    "    for (int i = ctrl_sp - 1; i >= 0 && ctrl[i].var >= 0; i--)\n"
+    "        if (var < 0 || ctrl[i].var == var) return i;\n"
+    "    return -1;\n"
+    "}\n"
+    "\n"
+    "static inline void push(int line, int var, int limit, int step, int pc) {\n"
+    "    if (ctrl_sp == 1024) stop(line, \"FOR/GOSUB nesting too deep\");\n"
+    "    ctrl[ctrl_sp].var = var;\n"
+    "    ctrl[ctrl_sp].limit = limit;\n"
+    "    ctrl[ctrl_sp].step = step;\n"
+    "    ctrl[ctrl_sp++].pc = pc;\n"
+    "}\n"
+    "\n"
+    "static inline void ctrl_for(int line, int var, int limit, int step, int pc) {\n"
+    "    int i = find_for(var);\n"
+    "    if (i >= 0) ctrl_sp = i;\n"
+    "    push(line, var, limit, step, pc);\n"
+    "}\n"
+    "\n"
+    "/* Step *x by frame f; nonzero if the loop goes on */\n"
+    "static inline int next_var(int* x, int f) {\n"
+    "    long long v = (long long)*x + ctrl[f].step;\n"
+    "    *x = (int)(unsigned int)v;\n"
+    "    if (ctrl[f].step >= 0 ? v <= ctrl[f].limit : v >= ctrl[f].limit) { ctrl_sp = f + 1; return 1; }\n"
+    "    ctrl_sp = f;\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "static inline int ctrl_return(void) {\n"
+    "    for (int i = ctrl_sp - 1; i >= 0; i--)\n"
+    "        if (ctrl[i].var < 0) { ctrl_sp = i; return ctrl[i].pc; }\n"
+    "    return -1;\n"
+    "}\n";
+
+static const char c_runtime_input[] =
+    "\n"
+    "/* INPUT: integers of stdin, anything else separates them */\n"
+    "static char in_buf[65536];\n"
+    "static int in_pos, in_len;\n"
+    "\n"
+    "static inline int in_fill(void) {\n"
+    "    out_flush();\n"
+    "    in_pos = 0;\n"
+    "    if (isatty(fileno(stdin))) in_len = fgets(in_buf, (int)sizeof(in_buf), stdin) ? (int)strlen(in_buf) : 0;\n"
+    "    else in_len = (int)fread(in_buf, 1, sizeof(in_buf), stdin);\n"
+    "    return in_len > 0;\n"
+    "}\n"
+    "\n"
+    "static inline int input(int line) {\n"
+    "    unsigned int v = 0;\n"
+    "    int neg = 0;\n"
+    "    for (;;) {\n"
+    "        if (in_pos == in_len && !in_fill()) stop(line, \"out of data\");\n"
+    "        if (in_buf[in_pos] >= '0' && in_buf[in_pos] <= '9') break;\n"
+    "        neg = in_buf[in_pos++] == '-';\n"
+    "    }\n"
+    "    while ((in_pos < in_len || in_fill()) && in_buf[in_pos] >= '0' && in_buf[in_pos] <= '9')\n"
+    "        v = v * 10 + (unsigned int)(in_buf[in_pos++] - '0');\n"
+    "    return (int)(neg ? 0u - v : v);\n"
+    "}\n";
+
+static const char c_runtime_read[] =
+    "\n"
+    "static inline int read_data(int line) {\n"
+    "    if (data_pos >= DATA_LEN) stop(line, \"out of data\");\n"
+    "    return data[data_pos++];\n"
+    "}\n";
+
+/* malloc'd printf, for the C expressions of a line */
+static char* c_fmt(const char* fmt, ...) {
+    va_list ap;
+    int n;
+    char* s;
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    s = (char*)malloc((size_t)n + 1);
+    va_start(ap, fmt);
+    vsnprintf(s, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    return s;
+}
+
+/* v as a C int constant */
+static char* c_int(int v) {
+    if (v == INT_MIN) return c_fmt("(-2147483647 - 1)");
+    return c_fmt(v < 0 ? "(%d)" : "%d", v);
+}
+
+/* s[0..len) as a C string literal, in pieces short enough for any compiler */
+static void c_string(FILE* f, const char* s, int len) {
+    putc('"', f);
+    for (int i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (i && i % 64 == 0) fputs("\" \"", f);
+        if (c == '"' || c == '\\' || c == '?') fprintf(f, "\\%c", c);
+        else if (c < ' ' || c > '~') fprintf(f, "\\%03o", c);
+        else putc(c, f);
+    }
+    putc('"', f);
+}
+
+/* Line source inside a C comment: no comment end or trigraph survives */
+typedef struct {
+    FILE* f;
+    int last;
+} CComment;
+
+static void write_c_comment(void* user, const char* data, size_t len) {
+    CComment* c = (CComment*)user;
+    for (size_t i = 0; i < len; i++) {
+        if ((c->last == '*' && data[i] == '/') || (c->last == '?' && data[i] == '?')) putc(' ', c->f);
+        c->last = (unsigned char)data[i];
+        putc(data[i], c->f);
+    }
+}
+
+/* What the program's code uses: returns C_* flags and fills in the
+   variables read, the line indices jumped to (label) and those FOR and
+   GOSUB frames continue at (resume). for_line[v] is the line of the only
+   FOR on v, -1 if there is none, -2 if there are several. */
+static int c_scan(const Program* prog, unsigned int* vars, char* label, char* resume, int* for_line) {
+    int uses = 0;
+    *vars = 0;
+    for (int v = 0; v < NUM_VARS; v++) for_line[v] = -1;
+    for (int i = 0; i < prog->num_lines; i++) {
+        const Line* ln = &prog->lines[i];
+        for (int at = 0; at < ln->code_len; at += op_len[ln->code[at]]) {
+            const int* ip = ln->code + at;
+            int op = ip[0], t = -1;
+            if (op == OP_LOAD || op == OP_INCV) *vars |= 1u << ip[1];
+            if (op == OP_LOADAV || op == OP_STOREAV) *vars |= 1u << ip[2];
+            if (op >= OP_JEQVC && op <= OP_JGEVV) {
+                *vars |= 1u << ip[1];
+                if (op >= OP_JEQVV) *vars |= 1u << ip[2];
+                t = find_line(prog->lines, prog->num_lines, ip[3]);
+            }
+            if (op == OP_GOTO || op == OP_IFGOTO || op == OP_GOSUB) t = find_line(prog->lines, prog->num_lines, ip[1]);
+            if (t >= 0) label[t] = 1;
+            if (op == OP_FOR || (op == OP_GOSUB && t >= 0)) resume[i + 1] = 1;  /* the last op of its line */
+            if (op == OP_FOR) for_line[ip[1]] = for_line[ip[1]] == -1 ? i : -2;
+            if (op == OP_LOADA || op == OP_STOREA || op == OP_DIM || op == OP_LOADAV || op == OP_STOREAV
+                || op == OP_INPUTA || op == OP_READA) uses |= C_ARRAYS;
+            if (op == OP_MAT || op == OP_MATSUM) uses |= C_ARRAYS | C_MAT;
+            if (op == OP_FOR || op == OP_NEXT || op == OP_RETURN || (op == OP_GOSUB && t >= 0)) uses |= C_CTRL;
+            if (op == OP_FOR) uses |= C_FOR;
+            if (op == OP_NEXT) uses |= C_NEXT;
+            if (op == OP_RETURN || (op == OP_NEXT && ip[1] < 0)) uses |= C_DISPATCH;
+            if (op == OP_INPUT || op == OP_INPUTA) uses |= C_INPUT;
+            if (op == OP_READ || op == OP_READA || op == OP_RESTORE) uses |= C_DATA;
+        }
+    }
+    for (int v = 0; v < NUM_VARS; v++) {
+        if (for_line[v] != -1 && (uses & C_NEXT)) *vars |= 1u << v;   /* NEXT steps it */
+        if (for_line[v] == -2) uses |= C_DISPATCH;
+        else if (for_line[v] >= 0) label[for_line[v] + 1] = 1;
+    }
+    if (uses & C_DISPATCH)
+        for (int i = 0; i <= prog->num_lines; i++) label[i] |= resume[i];
+    return uses;
+}
+
+/* Line i as C statements, its expressions built on the value stack st.
+   Variables never read are left out, as are the pure values stored in them. */
+static void c_line(const Program* prog, FILE* f, int i, char** st, const int* for_line, int uses, unsigned int vars) {
+    static const char* const arith[] = { "add", "sub", "mul", "quo" };
+    static const char* const cmp[] = { "==", "!=", "<", ">", "<=", ">=" };
+    const Line* ln = &prog->lines[i];
+    int sp = 0, num = ln->num;
+    for (int at = 0; at < ln->code_len; at += op_len[ln->code[at]]) {
+        const int* ip = ln->code + at;
+        int op = ip[0], t;
+        char* a, * b;
+        switch (op) {
+        case OP_PUSH: st[sp++] = c_int(ip[1]); break;
+        case OP_LOAD: st[sp++] = c_fmt("%c", 'A' + ip[1]); break;
+        case OP_LOADA:
+            a = st[sp - 1];
+            st[sp - 1] = c_fmt("ld(%d, %s)", ip[1], a);
+            free(a);
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+            a = st[sp - 2];
+            b = st[--sp];
+            st[sp - 1] = c_fmt("%s(%s, %s)", arith[op - OP_ADD], a, b);
+            free(a);
+            free(b);
+            break;
+        case OP_NEG: case OP_SHL:
+            a = st[sp - 1];
+            st[sp - 1] = op == OP_NEG ? c_fmt("neg(%s)", a) : c_fmt("shl(%s, %d)", a, ip[1]);
+            free(a);
+            break;
+        case OP_EQ: case OP_NE: case OP_LT: case OP_GT: case OP_LE: case OP_GE:
+            a = st[sp - 2];
+            b = st[--sp];
+            st[sp - 1] = c_fmt("%s %s %s", a, cmp[op - OP_EQ], b);
+            free(a);
+            free(b);
+            break;
+        case OP_STORE:
+            if (vars & (1u << ip[1])) fprintf(f, "    %c = %s;\n", 'A' + ip[1], st[sp - 1]);
+            free(st[--sp]);
+            break;
+        case OP_STOREA:
+            sp -= 2;
+            fprintf(f, "    st(%d, %s, %s);\n", ip[1], st[sp], st[sp + 1]);
+            free(st[sp]);
+            free(st[sp + 1]);
+            break;
+        case OP_DIM: fprintf(f, "    dim(%d, %d, %s);\n", num, ip[1], st[--sp]); free(st[sp]); break;
+        case OP_PRINTN: fprintf(f, "    out_int(%s);\n", st[--sp]); free(st[sp]); break;
+        case OP_PRINTS:
+            fputs("    out_str(", f);
+            c_string(f, prog->str_pool + ip[1], ip[2]);
+            fprintf(f, ", %d);\n", ip[2]);
+            break;
+        case OP_PRINTC:
+            if (ip[1] == '\n') fputs("    out_char('\\n');\n", f);
+            else if (ip[1] >= ' ' && ip[1] <= '~' && ip[1] != '\'' && ip[1] != '\\') fprintf(f, "    out_char('%c');\n", ip[1]);
+            else fprintf(f, "    out_char(%d);\n", ip[1]);
+            break;
+        case OP_GOTO:
+            if ((t = find_line(prog->lines, prog->num_lines, ip[1])) >= 0) fprintf(f, "    goto L_%d;\n", t);
+            break;
+        case OP_IFGOTO:
+            if ((t = find_line(prog->lines, prog->num_lines, ip[1])) >= 0) fprintf(f, "    if (%s) goto L_%d;\n", st[sp - 1], t);
+            free(st[--sp]);
+            break;
+        case OP_END: fputs("    out_flush();\n    return 0;\n", f); break;
+        case OP_INCV:
+            a = c_int(ip[2]);
+            fprintf(f, "    %c = add(%c, %s);\n", 'A' + ip[1], 'A' + ip[1], a);
+            free(a);
+            break;
+        case OP_LOADAV: st[sp++] = c_fmt("ld(%d, %c)", ip[1], 'A' + ip[2]); break;
+        case OP_STOREAV: fprintf(f, "    st(%d, %c, %s);\n", ip[1], 'A' + ip[2], st[--sp]); free(st[sp]); break;
+        case OP_FOR:
+            sp -= 2;
+            fprintf(f, "    ctrl_for(%d, %d, %s, %s, %d);\n", num, ip[1], st[sp], st[sp + 1], i + 1);
+            free(st[sp]);
+            free(st[sp + 1]);
+            break;
+        case OP_NEXT:
+            if (ip[1] >= 0 && for_line[ip[1]] >= 0) {
+                fprintf(f, "    if ((f = find_for(%d)) >= 0 && next_var(&%c, f)) goto L_%d;\n", ip[1], 'A' + ip[1], for_line[ip[1]] + 1);
+            } else if (ip[1] >= 0 && for_line[ip[1]] == -2) {
+                fprintf(f, "    if ((f = find_for(%d)) >= 0 && next_var(&%c, f)) { pc = ctrl[f].pc; goto resume; }\n", ip[1], 'A' + ip[1]);
+            } else if (ip[1] < 0 && (uses & C_FOR)) {
+                fputs("    if ((f = find_for(-1)) >= 0) {\n        switch (ctrl[f].var) {\n", f);
+                for (int v = 0; v < NUM_VARS; v++)
+                    if (for_line[v] != -1) fprintf(f, "        case %d: if (next_var(&%c, f)) { pc = ctrl[f].pc; goto resume; } break;\n", v, 'A' + v);
+                fputs("        }\n    }\n", f);
+            }
+            break;
+        case OP_GOSUB:
+            if ((t = find_line(prog->lines, prog->num_lines, ip[1])) >= 0)
+                fprintf(f, "    push(%d, -1, 0, 0, %d);\n    goto L_%d;\n", num, i + 1, t);
+            break;
+        case OP_RETURN: fputs("    if ((pc = ctrl_return()) >= 0) goto resume;\n", f); break;
+        case OP_MAT:
+            b = ip[4] < 0 && ip[3] != MAT_COPY ? st[--sp] : c_fmt("0");
+            a = ip[2] < 0 ? st[--sp] : c_fmt("0");
+            fprintf(f, "    mat(%d, %d, %s, %d, %d, %s);\n", ip[1], ip[2], a, ip[3], ip[4], b);
+            free(a);
+            free(b);
+            break;
+        case OP_MATSUM:
+            if (vars & (1u << ip[1])) fprintf(f, "    %c = mat_sum(%d);\n", 'A' + ip[1], ip[2]);
+            break;
+        case OP_INPUT:
+            if (vars & (1u << ip[1])) fprintf(f, "    %c = input(%d);\n", 'A' + ip[1], num);
+            else fprintf(f, "    (void)input(%d);\n", num);
+            break;
+        case OP_INPUTA: fprintf(f, "    st(%d, %s, input(%d));\n", ip[1], st[--sp], num); free(st[sp]); break;
+        case OP_READ:
+            if (vars & (1u << ip[1])) fprintf(f, "    %c = read_data(%d);\n", 'A' + ip[1], num);
+            else fprintf(f, "    (void)read_data(%d);\n", num);
+            break;
+        case OP_READA: fprintf(f, "    st(%d, %s, read_data(%d));\n", ip[1], st[--sp], num); free(st[sp]); break;
+        case OP_RESTORE: fprintf(f, "    data_pos = %d;\n", data_offset(prog, ip[1])); break;
+        default:
+            if (op >= OP_JEQVC && op <= OP_JGEVV && (t = find_line(prog->lines, prog->num_lines, ip[3])) >= 0) {
+                a = op >= OP_JEQVV ? c_fmt("%c", 'A' + ip[2]) : c_int(ip[2]);
+                fprintf(f, "    if (%c %s %s) goto L_%d;\n", 'A' + ip[1], cmp[(op - OP_JEQVC) % 6], a, t);
+                free(a);
+            }
+            break;
+        }
+    }
+}
+
+/* Does ln's code end with END? */
+static int c_ends(const Line* ln) {
+    int at = 0, last = -1;
+    for (; at < ln->code_len; at += op_len[ln->code[at]]) last = at;
+    return last >= 0 && ln->code[last] == OP_END;
+}
+
+/* The whole program as a C file; its line code must be compiled */
+static void write_c(const Program* prog, FILE* f) {
+    int n = prog->num_lines, stack = 1, uses, k = 0;
+    int for_line[NUM_VARS];
+    unsigned int vars;
+    char* label = (char*)calloc((size_t)n + 1, 1);
+    char* resume = (char*)calloc((size_t)n + 1, 1);
+    char** st;
+    uses = c_scan(prog, &vars, label, resume, for_line);
+    fputs("/* Tiny BASIC program translated by COMPILE; build with cc -O3 or cl /O2 */\n\n", f);
+    if (uses & C_INPUT) fputs("#ifdef _WIN32\n#include <io.h>\n#define isatty _isatty\n#define fileno _fileno\n#else\n#define _POSIX_C_SOURCE 200112L\n#include <unistd.h>\n#endif\n", f);
+    fputs(c_runtime, f);
+    if (uses & C_ARRAYS) fputs(c_runtime_arrays, f);
+    if (uses & C_MAT) fputs(c_runtime_mat, f);
+    if (uses & C_CTRL) fputs(c_runtime_ctrl, f);
+    if (uses & C_INPUT) fputs(c_runtime_input, f);
+    if (uses & C_DATA) {
+        fprintf(f, "\n#define DATA_LEN %d\nstatic const int data[] = {", prog->data_len);
+        for (int i = 0; i < prog->data_len; i++) {
+            char* v = c_int(prog->data[i]);
+            fprintf(f, "%s%s%s", i ? "," : "", i % 16 ? " " : "\n    ", v);
+            free(v);
+        }
+        fputs(prog->data_len ? "\n};\n" : " 0 };\n", f);
+        fputs("static int data_pos;\n", f);
+        fputs(c_runtime_read, f);
+    }
+
+    fputs("\nint main(void) {\n", f);
+    for (int v = 0; v < NUM_VARS; v++)
+        if (vars & (1u << v)) fprintf(f, "%s%c = 0", k++ ? ", " : "    int ", 'A' + v);
+    if (k) fputs(";\n", f);
+    if ((uses & C_NEXT) && (uses & C_FOR)) fputs("    int f;\n", f);
+    if (uses & C_DISPATCH) fputs("    int pc;\n", f);
+    for (int i = 0; i < n; i++)
+        if (prog->lines[i].stack_max > stack) stack = prog->lines[i].stack_max;
+    st = (char**)malloc((size_t)stack * sizeof(char*));
+    for (int i = 0; i < n; i++) {
+        CComment c = { f, 0 };
+        if (label[i]) fprintf(f, "L_%d: /* %d ", i, prog->lines[i].num);
+        else fprintf(f, "    /* %d ", prog->lines[i].num);
+        detokenize(prog, write_c_comment, &c, prog->lines[i].tok);
+        fputs(" */\n", f);
+        c_line(prog, f, i, st, for_line, uses, vars);
+    }
+    if (label[n]) fprintf(f, "L_%d:\n", n);
+    if (label[n] || !n || !c_ends(&prog->lines[n - 1])) fputs("    out_flush();\n    return 0;\n", f);
+    if (uses & C_DISPATCH) {
+        fputs("resume:\n    switch (pc) {\n", f);
+        for (int i = 0; i <= n; i++)
+            if (resume[i]) fprintf(f, "    case %d: goto L_%d;\n", i, i);
+        fputs("    }\n    return 0;\n", f);
+    }
+    fputs("}\n", f);
+    free(st);
+    free(label);
+    free(resume);
+}
+
+/* Translate the program to C in f, compiling its lines first if needed */
+static void compile_c(Interp* in, FILE* f) {
+    Program* prog = in->prog;
+    for (int i = 0; i < prog->num_lines; i++)
+        if (!prog->lines[i].code) { forget_line_code(prog); break; }
+    if (!prog->code_valid) compile_program(in);
+    write_c(prog, f);
+}
+
+/* COMPILE filename; returns 0 if the file was written */
+static int do_compile(Interp* in, const char* filename) {
+    FILE* f;
+    if (in->prog->num_lines == 0) {
+        printf("No program.\n");
+        return -1;
+    }
+    if (!(f = fopen(filename, "w"))) {
+        printf("Cannot create file: %s\n", filename);
+        return -1;
+    }
+    compile_c(in, f);
+    fclose(f);
+    printf("Saved %s\n", filename);
+    return 0;
+}
+
+/*
+ * Trace file (TRACE SAVE, -trace), oldest event first, in the image's
+ * little-endian words:
+ *
+ *   "TBASICTR" num_events dropped_lo dropped_hi
+ *   num_events x { type arg 0 0 (bytes), val }
+ */
+#define TRACE_MAGIC     "TBASICTR"
+
+static int trace_save(const Interp* in, const char* filename) {
+    const Trace* tr = in->trace_buf;
+    unsigned long long first = tr->count > TRACE_EVENTS ? tr->count - TRACE_EVENTS : 0;
+    FILE* f = fopen(filename, "wb");
+    if (!f) return -1;
+    fwrite(TRACE_MAGIC, 1, 8, f);
+    put_word(f, (int)(tr->count - first));
+    put_word(f, (int)(unsigned int)first);
+    put_word(f, (int)(unsigned int)(first >> 32));
+    for (unsigned long long i = first; i < tr->count; i++) {
+        const TraceEvent* e = &tr->ring[i & (TRACE_EVENTS - 1)];
+        unsigned char b[4] = { e->type, e->arg, 0, 0 };
+        fwrite(b, 1, 4, f);
+        put_word(f, e->val);
+    }
+    fclose(f);
+    return 0;
+}
+
+static void trace_print(Interp* in, int type, int arg, int val) {
+    if (type == TRACE_WRITE) {
+        out_fmt(in, "%8s %c = %d\n", "", 'A' + arg % NUM_VARS, val);
+    } else {
+        int known = arg >= 1 && arg <= (int)(sizeof(keyword_names) / sizeof(keyword_names[0]));
+        out_fmt(in, "%8d %s%s\n", val, known ? keyword_names[arg - 1] : "",
+                type == TRACE_JUMP ? "  (jump)" : "");
+    }
+}
+
+/* TRACE LIST [file]: decode a trace file, or the last run's trace */
+static void trace_list(Interp* in, const char* filename) {
+    if (filename) {
+        size_t size;
+        char* data = read_file(filename, &size);
+        ImageReader r;
+        const unsigned char* bytes;
+        unsigned long long dropped;
+        int n;
+        if (!data) {
+            printf("Cannot open file: %s\n", filename);
+            return;
+        }
+        r.p = (const unsigned char*)data;
+        r.end = r.p + size;
+        r.bad = 0;
+        bytes = image_take(&r, 8);
+        if (!bytes || memcmp(bytes, TRACE_MAGIC, 8) != 0) {
+            printf("Not a trace: %s\n", filename);
+            free(data);
+            return;
+        }
+        n = image_word(&r);
+        dropped = (unsigned int)image_word(&r);
+        dropped |= (unsigned long long)(unsigned int)image_word(&r) << 32;
+        if (n < 0 || (size_t)n > size / 8) r.bad = 1;
+        if (!r.bad) out_fmt(in, "Trace: last %d of %llu events\n", n, dropped + (unsigned long long)n);
+        for (int i = 0; i < n && !r.bad; i++) {
+            bytes = image_take(&r, 4);
+            if (bytes) trace_print(in, bytes[0], bytes[1], image_word(&r));
+        }
+        if (r.bad) printf("Corrupt trace: %s\n", filename);
+        free(data);
+    } else if (in->trace_buf) {
+        const Trace* tr = in->trace_buf;
+        unsigned long long first = tr->count > TRACE_EVENTS ? tr->count - TRACE_EVENTS : 0;
+        out_fmt(in, "Trace: last %d of %llu events\n", (int)(tr->count - first), tr->count);
+        for (unsigned long long i = first; i < tr->count; i++) {
+            const TraceEvent* e = &tr->ring[i & (TRACE_EVENTS - 1)];
+            trace_print(in, e->type, e->arg, e->val);
+        }
+    } else {
+        printf("No trace.\n");
+    }
+    out_flush(in);
+}
+
+/*
+ * Checkpoint (CHECKPOINT, -checkpoint): everything a stopped run needs to
+ * go on, tied to the compiled program by a hash of its code, so it can
+ * only be resumed with the same program compiled with the same settings.
+ * A run is only stopped with an empty value stack, so the state is the
+ * resume offset, the variables, the control stack, the READ position and
+ * the arrays; INPUT goes on wherever its source is. Words
+ * are little-endian like the image; each array's elements follow its size
+ * in one write, as they are in memory. The file is written under a
+ * temporary name and renamed, so a crash never leaves a torn checkpoint.
+ *
+ *   "TBASICCK" version hash_lo hash_hi pc ctrl_sp data_pos  NUM_VARS x var
+ *   ctrl_sp x { var, limit, step, pc }  NUM_VARS x { size, elements }
+ */
+#define CHECKPOINT_MAGIC    "TBASICCK"
+#define CHECKPOINT_VERSION  2
+
+static unsigned long long program_hash(const Program* prog) {
+    unsigned long long h = 14695981039346656037ull;
+    for (int i = 0; i < prog->num_lines; i++) h = (h ^ (unsigned int)prog->lines[i].num) * 1099511628211ull;
+    for (int i = 0; i < prog->code_len; i++) h = (h ^ (unsigned int)prog->code[i]) * 1099511628211ull;
+    for (int i = 0; i < prog->str_len; i++) h = (h ^ (unsigned char)prog->str_pool[i]) * 1099511628211ull;
+    for (int i = 0; i < prog->data_len; i++) h = (h ^ (unsigned int)prog->data[i]) * 1099511628211ull;
+    return h;
+}
+
+/* Is pc the start of an instruction? */
+static int code_boundary(const Program* prog, int pc) {
+    int at = 0;
+    while (at < pc) at += op_len[prog->code[at]];
+    return at == pc && pc < prog->code_len;
+}
+
+static int checkpoint_save(const Interp* in, const char* filename) {
+    unsigned long long h = program_hash(in->prog);
+    size_t n = strlen(filename);
+    char* tmp = (char*)malloc(n + 5);
+    FILE* f;
+    int ok;
+    memcpy(tmp, filename, n);
+    memcpy(tmp + n, ".tmp", 5);
+    f = fopen(tmp, "wb");
+    if (!f) { free(tmp); return -1; }
+    fwrite(CHECKPOINT_MAGIC, 1, 8, f);
+    put_word(f, CHECKPOINT_VERSION);
+    put_word(f, (int)(unsigned int)h);
+    put_word(f, (int)(unsigned int)(h >> 32));
+    put_word(f, in->stop_pc);
+    put_word(f, in->ctrl_sp);
+    put_word(f, in->data_pos);
+    for (int v = 0; v < NUM_VARS; v++) put_word(f, in->vars[v]);
+    for (int i = 0; i < in->ctrl_sp; i++) {
+        put_word(f, in->ctrl[i].var);
+        put_word(f, in->ctrl[i].limit);
+        put_word(f, in->ctrl[i].step);
+        put_word(f, in->ctrl[i].pc);
+    }
+    for (int v = 0; v < NUM_VARS; v++) {
+        put_word(f, in->array_sizes[v]);
+        if (in->array_sizes[v]) fwrite(in->arrays[v], sizeof(int), (size_t)in->array_sizes[v], f);
+    }
+    ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+    if (ok) remove(filename);
+#endif
+    ok = ok && rename(tmp, filename) == 0;
+    if (!ok) remove(tmp);
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+static int checkpoint_word(FILE* f, int* bad) {
+    unsigned char b[4];
+    if (fread(b, 1, 4, f) != 4) { *bad = 1; return 0; }
+    return get_int(b);
+}
+
+/* Restore a checkpoint of the current program; returns the offset to go
+   on at, or -1 after printing why not */
+static int checkpoint_load(Interp* in, const char* filename) {
+    Program* prog = in->prog;
+    unsigned char magic[8];
+    unsigned long long h;
+    int bad = 0, version, pc, sp, pos;
+    FILE* f;
+    if (prog->num_lines == 0) {
+        printf("No program.\n");
+        return -1;
+    }
+    if (!prog->code_valid) compile_program(in);
+    f = fopen(filename, "rb");
+    if (!f) {
+        printf("Cannot open file: %s\n", filename);
+        return -1;
+    }
+    if (fread(magic, 1, 8, f) != 8 || memcmp(magic, CHECKPOINT_MAGIC, 8) != 0) {
+        printf("Not a checkpoint: %s\n", filename);
+        fclose(f);
+        return -1;
+    }
+    version = checkpoint_word(f, &bad);
+    if (version != CHECKPOINT_VERSION) {
+        printf("Unsupported checkpoint version %d: %s\n", version, filename);
+        fclose(f);
+        return -1;
+    }
+    h = (unsigned int)checkpoint_word(f, &bad);
+    h |= (unsigned long long)(unsigned int)checkpoint_word(f, &bad) << 32;
+    if (!bad && h != program_hash(prog)) {
+        printf("Checkpoint is for another program or settings: %s\n", filename);
+        fclose(f);
+        return -1;
+    }
+    pc = checkpoint_word(f, &bad);
+    sp = checkpoint_word(f, &bad);
+    pos = checkpoint_word(f, &bad);
+    if (pc < 0 || pc >= prog->code_len || !code_boundary(prog, pc) || sp < 0 || sp > CTRL_DEPTH
+        || pos < 0 || pos > prog->data_len)
+        bad = 1;
+    init_vars(in);
+    in->data_pos = pos;
+    for (int v = 0; v < NUM_VARS && !bad; v++) in->vars[v] = checkpoint_word(f, &bad);
+    for (int i = 0; i < sp && !bad; i++) {
+        CtrlFrame* fr = &in->ctrl[i];
+        fr->var = checkpoint_word(f, &bad);
+        fr->limit = checkpoint_word(f, &bad);
+        fr->step = checkpoint_word(f, &bad);
+        fr->pc = checkpoint_word(f, &bad);
+        if (fr->var < -1 || fr->var >= NUM_VARS || fr->pc < 0 || fr->pc >= prog->code_len || !code_boundary(prog, fr->pc)) bad = 1;
+    }
+    in->ctrl_sp = bad ? 0 : sp;
+    for (int v = 0; v < NUM_VARS && !bad; v++) {
+        int n = checkpoint_word(f, &bad);
+        if (bad || n == 0) continue;
+        if (n < 0) { bad = 1; break; }
+        if (dim_array(in, v, n) != BASIC_OK) {
+            printf("Checkpoint arrays exceed the memory limit: %s\n", filename);
+            fclose(f);
+            init_vars(in);
+            return -1;
+        }
+        if (fread(in->arrays[v], sizeof(int), (size_t)n, f) != (size_t)n) bad = 1;
+    }
+    fclose(f);
+    if (bad) {
+        printf("Corrupt checkpoint: %s\n", filename);
+        init_vars(in);
+        return -1;
+    }
+    return pc;
+}
+
+/* TRACE ON [A, B, ...]: the variables to watch, all of them if none are
+   listed; -1 if the list is malformed */
+static long long trace_var_list(const char* p) {
+    unsigned int vars = 0;
+    for (; *p; p++) {
+        if (*p >= 'A' && *p <= 'Z') vars |= 1u << (*p - 'A');
+        else if (*p != ',' && *p != ' ' && *p != '\t') return -1;
+    }
+    return vars ? vars : (1u << NUM_VARS) - 1;
+}
+
+/* OPTIMIZE: what the control flow passes and hoisting did to the program */
+static void report_control_flow(Interp* in) {
+    Program* prog = in->prog;
+    int n = 0, values = 0;
+    if (!prog->code_valid) compile_program(in);
+    for (int i = 0; i < prog->num_lines; i++) n += prog->lines[i].unreachable;
+    printf("Threaded %d jump%s; %d unreachable line%s left out", prog->num_threaded,
+           prog->num_threaded == 1 ? "" : "s", n, n == 1 ? "" : "s");
+    for (int i = 0, k = 0; i < prog->num_lines; i++) {
+        if (prog->lines[i].unreachable) printf("%s%d", k++ ? " " : ": ", prog->lines[i].num);
+    }
+    printf(".\n");
+    n = 0;
+    for (int k = 0; k < prog->num_loops; k++) {
+        const Loop* L = &prog->loops[k];
+        for (int pc = L->pre; pc < L->body; pc += op_len[prog->code[pc]]) values += prog->code[pc] == OP_STORE;
+        n += L->body > L->pre;
+    }
+    printf("Hoisted %d value%s out of %d loop%s", values, values == 1 ? "" : "s", n, n == 1 ? "" : "s");
+    for (int i = 0, k = 0; i < prog->num_lines; i++) {
+        for (int j = 0; j < prog->num_loops; j++) {
+            const Loop* L = &prog->loops[j];
+            if (L->body > L->pre && prog->pc_line[L->pre] == i) printf("%s%d", k++ ? " " : ": ", prog->lines[i].num);
+        }
+    }
+    printf(".\n");
+}
+
+/* Process direct statement (no line number) or add program line */
+static int process_input(Interp* in, char* buf) {
+    Program* prog = in->prog;
+    /* Trim newline */
+    size_t len = strlen(buf);
+    if (len > 0 && buf[len - 1] == '\n') { buf[len - 1] = '\0'; len--; }
+
+    const char* p = buf;
+    while (*p == ' ' || *p == '\t') p++;
+    if (!*p) return 0;
+
+    /* Line number at start => program line */
+    if (isdigit((unsigned char)*p)) {
+        int line_num = 0;
+        while (isdigit((unsigned char)*p)) { line_num = line_num * 10 + (*p - '0'); p++; }
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p) add_line(prog, line_num, p);
+        else delete_line(prog, line_num);
+        return 0;
+    }
+
+    /* Direct commands */
+    if (strncmp(p, "RUN", 3) == 0 && (p[3] == '\0' || p[3] == ' ' || p[3] == '\t')) {
+        do_run(in);
+        return 0;
+    }
+    if (strncmp(p, "RESUME", 6) == 0 && (p[6] == '\0' || p[6] == ' ' || p[6] == '\t')) {
+        p += 6;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p) {
+            int pc = checkpoint_load(in, p);
+            if (pc >= 0) report_run(in, run_compiled(in, pc));
+        } else if (in->stop_pc >= 0 && prog->code_valid) {
+            report_run(in, run_compiled(in, in->stop_pc));
+        } else {
+            printf("Nothing to resume.\n");
+        }
+        return 0;
+    }
+    if (strncmp(p, "CHECKPOINT", 10) == 0 && (p[10] == ' ' || p[10] == '\t')) {
+        p += 10;
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) printf("Usage: CHECKPOINT filename\n");
+        else if (in->stop_pc < 0 || !prog->code_valid) printf("Nothing to checkpoint.\n");
+        else if (checkpoint_save(in, p) != 0) printf("Cannot create file: %s\n", p);
+        else printf("Saved %s\n", p);
+        return 0;
     }
     if (strncmp(p, "LIST", 4) == 0 && (p[4] == '\0' || p[4] == ' ' || p[4] == '\t')) {
-        do_list();
+        do_list(prog);
+        return 0;
+    }
+    if (strncmp(p, "NEW", 3) == 0 && (p[3] == '\0' || p[3] == ' ' || p[3] == '\t')) {
+        do_new(prog);
+        return 0;
+    }
+    if (strncmp(p, "QUIT", 4) == 0 && (p[4] == '\0' || p[4] == ' ' || p[4] == '\t')) {
+        return 1;
+    }
+    if (strncmp(p, "OPTIMIZE", 8) == 0 && (p[8] == '\0' || p[8] == ' ' || p[8] == '\t')) {
+        p += 8;
+        while (*p == ' ' || *p == '\t') p++;
+        if (strcmp(p, "ON") == 0) { in->optimize = 1; forget_line_code(prog); }
+        else if (strcmp(p, "OFF") == 0) { in->optimize = 0; forget_line_code(prog); }
+        else if (*p) { printf("Usage: OPTIMIZE [ON|OFF]\n"); return 0; }
+        printf("Optimizer %s.\n", in->optimize ? "on" : "off");
+        if (!*p && in->optimize && prog->num_lines) report_control_flow(in);
+        return 0;
+    }
+    if (strncmp(p, "PROFILE", 7) == 0 && (p[7] == '\0' || p[7] == ' ' || p[7] == '\t')) {
+        p += 7;
+        while (*p == ' ' || *p == '\t') p++;
+        if (strcmp(p, "ON") == 0) { in->profile = 1; prog->code_valid = 0; }
+        else if (strcmp(p, "OFF") == 0) { in->profile = 0; prog->code_valid = 0; }
+        else if (*p) { printf("Usage: PROFILE [ON|OFF]\n"); return 0; }
+        printf("Profiler %s.\n", in->profile ? "on" : "off");
+        return 0;
+    }
+    if (strncmp(p, "TRACE", 5) == 0 && (p[5] == '\0' || p[5] == ' ' || p[5] == '\t')) {
+        long long vars;
+        p += 5;
+        while (*p == ' ' || *p == '\t') p++;
+        if (strncmp(p, "LIST", 4) == 0 && (p[4] == '\0' || p[4] == ' ' || p[4] == '\t')) {
+            p += 4;
+            while (*p == ' ' || *p == '\t') p++;
+            trace_list(in, *p ? p : NULL);
+            return 0;
+        }
+        if (strncmp(p, "SAVE", 4) == 0 && (p[4] == ' ' || p[4] == '\t')) {
+            p += 4;
+            while (*p == ' ' || *p == '\t') p++;
+            if (!in->trace_buf) printf("No trace.\n");
+            else if (trace_save(in, p) != 0) printf("Cannot create file: %s\n", p);
+            else printf("Saved %s\n", p);
+            return 0;
+        }
+        if (strncmp(p, "ON", 2) == 0 && (p[2] == '\0' || p[2] == ' ' || p[2] == '\t') && (vars = trace_var_list(p + 2)) >= 0) {
+            in->trace = 1;
+            in->trace_vars = (unsigned int)vars;
+            prog->code_valid = 0;
+        } else if (strcmp(p, "OFF") == 0) {
+            in->trace = 0;
+            prog->code_valid = 0;
+        } else if (*p) {
+            printf("Usage: TRACE [ON [var, ...]|OFF|LIST [file]|SAVE file]\n");
+            return 0;
+        }
+        printf("Trace %s.\n", in->trace ? "on" : "off");
+        return 0;
+    }
+    if (strncmp(p, "BUFFER", 6) == 0 && (p[6] == '\0' || p[6] == ' ' || p[6] == '\t')) {
+        p += 6;
+        while (*p == ' ' || *p == '\t') p++;
+        if (strcmp(p, "ON") == 0) in->out_unbuffered = 0;
+        else if (strcmp(p, "OFF") == 0) in->out_unbuffered = 1;
+        else if (*p) { printf("Usage: BUFFER [ON|OFF]\n"); return 0; }
+        printf("Output buffering %s.\n", in->out_unbuffered ? "off" : "on");
+        return 0;
+    }
+    if (strncmp(p, "JIT", 3) == 0 && (p[3] == '\0' || p[3] == ' ' || p[3] == '\t')) {
+        p += 3;
+        while (*p == ' ' || *p == '\t') p++;
+        if (!JIT_SUPPORTED) { printf("JIT not available on this platform.\n"); return 0; }
+        if (strcmp(p, "ON") == 0) in->jit_enabled = 1;
+        else if (strcmp(p, "OFF") == 0) in->jit_enabled = 0;
+        else if (*p) { printf("Usage: JIT [ON|OFF]\n"); return 0; }
+        printf("JIT %s.\n", in->jit_enabled ? "on" : "off");
+        return 0;
+    }
+    if (strncmp(p, "LOAD", 4) == 0 && (p[4] == ' ' || p[4] == '\t')) {
+        p += 4;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p) do_load(prog, p);
+        else printf("Usage: LOAD filename\n");
         return 0;
     }
-    if (strncmp(p, "NEW", 3) == 0 && (p[3] == '\0' || p[3] == ' ' || p[3] == '\t')) {
-        do_new();
-        return 0;
+    if (strncmp(p, "CLOAD", 5) == 0 && (p[5] == ' ' || p[5] == '\t')) {
+        p += 5;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p) do_cload(in, p);
+        else printf("Usage: CLOAD filename\n");
+        return 0;
+    }
+    if (strncmp(p, "CSAVE", 5) == 0 && (p[5] == ' ' || p[5] == '\t')) {
+        p += 5;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p) do_csave(in, p);
+        else printf("Usage: CSAVE filename\n");
+        return 0;
+    }
+    if (strncmp(p, "COMPILE", 7) == 0 && (p[7] == ' ' || p[7] == '\t')) {
+        p += 7;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p) do_compile(in, p);
+        else printf("Usage: COMPILE filename\n");
+        return 0;
+    }
+    if (strncmp(p, "SAVE", 4) == 0 && (p[4] == ' ' || p[4] == '\t')) {
+        p += 4;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p) do_save(prog, p);
+        else printf("Usage: SAVE filename\n");
+        return 0;
+    }
+
+    /* Direct statement: PRINT, LET, DIM, etc. (execute once, no GOTO/IF target) */
+    {
+        Line fake;
+        fake.num = 0;
+        execute_line_text(in, p, 0, 1, &fake);
+    }
+    return 0;
+}
+
+/* Embedding API, see basic.h */
+
+static Interp* interp_new(Program* prog) {
+    Interp* in = (Interp*)calloc(1, sizeof(Interp));
+    in->prog = prog;
+    in->write = write_file;
+    in->write_user = stdout;
+    in->read = read_stream;
+    in->read_user = stdin;
+    in->optimize = 1;
+    in->jit_enabled = JIT_SUPPORTED;
+    in->stop_pc = -1;
+    return in;
+}
+
+/* New context for running the compiled program of src with its own
+   variables and output. The program is only read, so any number of such
+   contexts may run at once; src must outlive them and must not edit it. */
+static Interp* interp_share(Interp* src) {
+    Interp* in = interp_new(src->prog);
+    in->prog_shared = 1;
+    in->optimize = src->optimize;
+    in->jit_enabled = src->jit_enabled;
+    in->par_threads = src->par_threads;
+    basic_set_limits(in, src->max_steps, src->max_ms, src->max_array_bytes);
+    return in;
+}
+
+Interp* basic_create(void) {
+    return interp_new((Program*)calloc(1, sizeof(Program)));
+}
+
+Interp* basic_share(Interp* src) {
+    if (src->prog->num_lines && !src->prog->code_valid) compile_program(src);
+    return interp_share(src);
+}
+
+void basic_destroy(Interp* in) {
+    Program* prog = in->prog;
+    for (int i = 0; i < NUM_VARS; i++) free_array_block(&in->array_blocks[i]);
+    if (!in->prog_shared) {
+        clear_program(prog);
+        free(prog->lines);
+        free(prog->str_pool);
+        free(prog->strs);
+        free(prog->str_hash);
+        free(prog);
+    }
+    free(in->code_buf);
+    free(in->nodes);
+    free(in->input_buf);
+    profile_free(in->prof);
+    free(in->trace_buf);
+    jit_free(in);
+    free(in);
+}
+
+void basic_set_output(Interp* in, BasicWriteFn fn, void* user) {
+    out_flush(in);
+    in->write = fn;
+    in->write_user = user;
+}
+
+void basic_set_input(Interp* in, BasicReadFn fn, void* user) {
+    in->read = fn;
+    in->read_user = user;
+    in->input_pos = in->input_len = 0;
+}
+
+void basic_load(Interp* in, const char* text, size_t len) {
+    char* data = (char*)malloc(len + 1);
+    memcpy(data, text, len);
+    data[len] = '\0';
+    load_text(in->prog, data, len);
+    free(data);
+}
+
+int basic_exec(Interp* in, const char* line) {
+    size_t len = strlen(line);
+    char* buf = (char*)malloc(len + 1);
+    int quit;
+    memcpy(buf, line, len + 1);
+    quit = process_input(in, buf);
+    free(buf);
+    return quit;
+}
+
+void basic_set_limits(Interp* in, long long max_steps, long long max_ms, long long max_array_bytes) {
+    in->max_steps = max_steps > 0 ? max_steps : 0;
+    in->max_ms = max_ms > 0 ? max_ms : 0;
+    in->max_array_bytes = max_array_bytes > 0 ? max_array_bytes : 0;
+}
+
+void basic_set_threads(Interp* in, int threads) {
+    in->par_threads = threads > 0 ? threads : 0;
+}
+
+void basic_interrupt(Interp* in) {
+    in->interrupt = 1;
+}
+
+void basic_set_checkpoint(Interp* in, const char* filename, long long every) {
+    in->checkpoint_file = filename;
+    in->checkpoint_every = filename && every > 0 ? every : 0;
+}
+
+void basic_request_checkpoint(Interp* in) {
+    in->checkpoint_request = 1;
+}
+
+int basic_resume(Interp* in, const char* filename) {
+    int pc = checkpoint_load(in, filename);
+    return pc >= 0 ? run_compiled(in, pc) : BASIC_NO_PROGRAM;
+}
+
+int basic_get_var(Interp* in, int var) {
+    return var >= 0 && var < NUM_VARS ? in->vars[var] : 0;
+}
+
+void basic_set_var(Interp* in, int var, int value) {
+    if (var >= 0 && var < NUM_VARS) in->vars[var] = value;
+}
+
+#ifndef BASIC_NO_MAIN
+/* INPUT a line at a time, from a stream the prompt also reads commands from */
+static size_t read_stream_line(void* user, char* buf, size_t len) {
+    return fgets(buf, (int)len, (FILE*)user) ? strlen(buf) : 0;
+}
+
+/* Read one line of any length into *buf (grown as needed), keeping the
+   newline like fgets(). Returns 0, or -1 at end of file. */
+static int read_line(FILE* f, char** buf, size_t* cap) {
+    size_t len = 0;
+    int c;
+    while ((c = getc(f)) != EOF) {
+        if (len + 2 > *cap) {
+            *cap = *cap ? *cap * 2 : 256;
+            *buf = (char*)realloc(*buf, *cap);
+        }
+        (*buf)[len++] = (char)c;
+        if (c == '\n') break;
+    }
+    if (len == 0) return -1;
+    (*buf)[len] = '\0';
+    return 0;
+}
+
+/*
+ * Batch mode: basic -batch [-j threads] target... runs many programs on a
+ * work-stealing thread pool. A target is a program file, a directory (its
+ * .bas files) or @list, a file with one job per line: a program file
+ * followed by optional VAR=value presets. Each distinct file is loaded and
+ * compiled once and shared read-only by all of its jobs; every job gets
+ * its own context and output buffer, and outputs are printed in job order
+ * once everything has run. Jobs get no INPUT: it stops them out of data.
+ */
+typedef struct {
+    char* path;
+    Interp* in;             /* loaded and compiled, or NULL if unreadable */
+} BatchProgram;
+
+/* Growable byte buffer used as an output callback target */
+typedef struct {
+    char* data;
+    size_t len, cap;
+} Capture;
+
+static void write_capture(void* user, const char* data, size_t len) {
+    Capture* c = (Capture*)user;
+    if (c->len + len > c->cap) {
+        while (c->len + len > c->cap) c->cap = c->cap ? c->cap * 2 : 4096;
+        c->data = (char*)realloc(c->data, c->cap);
     }
-    if (strncmp(p, "QUIT", 4) == 0 && (p[4] == '\0' || p[4] == ' ' || p[4] == '\t')) {
-        return 1;
+    memcpy(c->data + c->len, data, len);
+    c->len += len;
+}
+
+typedef struct {
+    char* label;            /* the job as written: file and presets */
+    int prog;               /* index into programs */
+    int preset_mask;        /* bit v set: vars[v] starts at preset[v] */
+    int preset[NUM_VARS];
+    Capture out;
+    int status;             /* basic_run() result */
+} BatchJob;
+
+typedef struct {
+    BatchProgram* programs;
+    int num_programs, programs_cap;
+    BatchJob* jobs;
+    int num_jobs, jobs_cap;
+    long long limits[3];    /* for every job, see limit_option() */
+} Batch;
+
+static void capture_str(Capture* c, const char* s) {
+    write_capture(c, s, strlen(s));
+}
+
+static void batch_load(void* ctx, int task) {
+    BatchProgram* bp = &((Batch*)ctx)->programs[task];
+    size_t size;
+    char* data = read_file(bp->path, &size);
+    if (!data) return;
+    bp->in = basic_create();
+    load_text(bp->in->prog, data, size);
+    free(data);
+    if (bp->in->prog->num_lines) compile_program(bp->in);
+}
+
+static void batch_run(void* ctx, int task) {
+    Batch* b = (Batch*)ctx;
+    BatchJob* job = &b->jobs[task];
+    BatchProgram* bp = &b->programs[job->prog];
+    Interp* in;
+    if (!bp->in) {
+        capture_str(&job->out, "Cannot open file: ");
+        capture_str(&job->out, bp->path);
+        capture_str(&job->out, "\n");
+        return;
     }
-    if (strncmp(p, "LOAD", 4) == 0 && (p[4] == ' ' || p[4] == '\t')) {
-        p += 4;
+    if (bp->in->prog->num_lines == 0) {
+        capture_str(&job->out, "No program.\n");
+        return;
+    }
+    in = interp_share(bp->in);
+    basic_set_threads(in, 1);     /* the pool already keeps every core busy */
+    basic_set_output(in, write_capture, &job->out);
+    basic_set_input(in, NULL, NULL);
+    init_vars(in);
+    for (int v = 0; v < NUM_VARS; v++) {
+        if (job->preset_mask & (1 << v)) in->vars[v] = job->preset[v];
+    }
+    basic_set_limits(in, b->limits[0], b->limits[1], b->limits[2]);
+    job->status = run_compiled(in, 0);
+    if (job->status != BASIC_OK) {
+        char msg[64];
+        stop_message(in, job->status, msg, sizeof(msg));
+        capture_str(&job->out, msg);
+    }
+    basic_destroy(in);
+}
+
+static char* copy_string(const char* s, size_t len) {
+    char* d = (char*)malloc(len + 1);
+    memcpy(d, s, len);
+    d[len] = '\0';
+    return d;
+}
+
+/* VAR=value presets separated by blanks into preset[] and *mask;
+   -1 if malformed */
+static int parse_presets(const char* spec, int* mask, int* preset) {
+    for (const char* p = spec; *p; ) {
+        int v, neg;
+        unsigned int n = 0;
         while (*p == ' ' || *p == '\t') p++;
-        if (*p) do_load(p);
-        else printf("Usage: LOAD filename\n");
-        return 0;
+        if (!*p) break;
+        if (*p < 'A' || *p > 'Z' || p[1] != '=') return -1;
+        v = *p - 'A';
+        p += 2;
+        neg = (*p == '-');
+        if (*p == '-' || *p == '+') p++;
+        if (!isdigit((unsigned char)*p)) return -1;
+        while (isdigit((unsigned char)*p)) n = n * 10 + (unsigned int)(*p++ - '0');
+        if (*p && *p != ' ' && *p != '\t') return -1;
+        preset[v] = (int)(neg ? 0u - n : n);
+        *mask |= 1 << v;
     }
-    if (strncmp(p, "SAVE", 4) == 0 && (p[4] == ' ' || p[4] == '\t')) {
-        p += 4;
+    return 0;
+}
+
+/* Add a job for program file path (len bytes) with presets in spec
+   (VAR=value words); returns -1 if a preset is malformed */
+static int batch_add(Batch* b, const char* path, size_t len, const char* spec) {
+    BatchJob* job;
+    int prog = -1;
+    for (int i = 0; i < b->num_programs; i++) {
+        if (strlen(b->programs[i].path) == len && memcmp(b->programs[i].path, path, len) == 0) { prog = i; break; }
+    }
+    if (prog < 0) {
+        if (b->num_programs == b->programs_cap) {
+            b->programs_cap = b->programs_cap ? b->programs_cap * 2 : 64;
+            b->programs = (BatchProgram*)realloc(b->programs, (size_t)b->programs_cap * sizeof(BatchProgram));
+        }
+        prog = b->num_programs++;
+        b->programs[prog].path = copy_string(path, len);
+        b->programs[prog].in = NULL;
+    }
+    if (b->num_jobs == b->jobs_cap) {
+        b->jobs_cap = b->jobs_cap ? b->jobs_cap * 2 : 64;
+        b->jobs = (BatchJob*)realloc(b->jobs, (size_t)b->jobs_cap * sizeof(BatchJob));
+    }
+    job = &b->jobs[b->num_jobs];
+    memset(job, 0, sizeof(*job));
+    job->prog = prog;
+    if (parse_presets(spec, &job->preset_mask, job->preset) != 0) return -1;
+    job->label = (char*)malloc(len + strlen(spec) + 1);
+    memcpy(job->label, path, len);
+    strcpy(job->label + len, spec);
+    b->num_jobs++;
+    return 0;
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* Add a job for each .bas file in dir, by name; returns -1 if dir is not a directory */
+static int batch_add_dir(Batch* b, const char* dir) {
+    char** names = NULL;
+    int n = 0, cap = 0;
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h;
+    char* pattern = (char*)malloc(strlen(dir) + 8);
+    DWORD attr = GetFileAttributesA(dir);
+    if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY)) { free(pattern); return -1; }
+    sprintf(pattern, "%s\\*.bas", dir);
+    h = FindFirstFileA(pattern, &fd);
+    free(pattern);
+    if (h != INVALID_HANDLE_VALUE) {
+        do {
+            if (n == cap) { cap = cap ? cap * 2 : 64; names = (char**)realloc(names, (size_t)cap * sizeof(char*)); }
+            names[n++] = copy_string(fd.cFileName, strlen(fd.cFileName));
+        } while (FindNextFileA(h, &fd));
+        FindClose(h);
+    }
+#else
+    DIR* d = opendir(dir);
+    struct dirent* e;
+    if (!d) return -1;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len < 5 || strcmp(e->d_name + len - 4, ".bas") != 0) continue;
+        if (n == cap) { cap = cap ? cap * 2 : 64; names = (char**)realloc(names, (size_t)cap * sizeof(char*)); }
+        names[n++] = copy_string(e->d_name, len);
+    }
+    closedir(d);
+#endif
+    if (n) qsort(names, (size_t)n, sizeof(char*), compare_names);
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(dir) + 1 + strlen(names[i]);
+        char* path = (char*)malloc(len + 1);
+        sprintf(path, "%s/%s", dir, names[i]);
+        batch_add(b, path, len, "");
+        free(path);
+        free(names[i]);
+    }
+    free(names);
+    return 0;
+}
+
+/* Add the jobs of a list file, one per nonblank line */
+static int batch_add_list(Batch* b, const char* filename) {
+    size_t size;
+    char* data = read_file(filename, &size);
+    char *p, *end;
+    if (!data) {
+        printf("Cannot open file: %s\n", filename);
+        return -1;
+    }
+    end = data + size;
+    for (p = data; p < end; ) {
+        char* eol = (char*)memchr(p, '\n', (size_t)(end - p));
+        char* next;
+        const char* path;
+        if (!eol) eol = end;
+        next = eol < end ? eol + 1 : end;
+        if (eol > p && eol[-1] == '\r') eol--;
+        *eol = '\0';
         while (*p == ' ' || *p == '\t') p++;
-        if (*p) do_save(p);
-        else printf("Usage: SAVE filename\n");
-        return 0;
+        path = p;
+        while (*p && *p != ' ' && *p != '\t') p++;
+        if (p > path && batch_add(b, path, (size_t)(p - path), p) != 0) {
+            printf("Bad job: %s\n", path);
+            free(data);
+            return -1;
+        }
+        p = next;
+    }
+    free(data);
+    return 0;
+}
+
+/* Add the jobs for one command line target: @list, directory or file */
+static int batch_add_target(Batch* b, const char* arg) {
+    if (arg[0] == '@') return batch_add_list(b, arg + 1);
+    if (batch_add_dir(b, arg) != 0) batch_add(b, arg, strlen(arg), "");
+    return 0;
+}
+
+static void batch_free(Batch* b) {
+    for (int i = 0; i < b->num_jobs; i++) {
+        free(b->jobs[i].out.data);
+        free(b->jobs[i].label);
+    }
+    for (int i = 0; i < b->num_programs; i++) {
+        if (b->programs[i].in) basic_destroy(b->programs[i].in);
+        free(b->programs[i].path);
     }
+    free(b->programs);
+    free(b->jobs);
+}
 
-    /* Direct statement: PRINT, LET, DIM, etc. (execute once, no GOTO/IF target) */
-    {
-        Line fake;
-        fake.num = 0;
-        strncpy(fake.text, p, MAX_LINELEN - 1);
-        fake.text[MAX_LINELEN - 1] = '\0';
-        execute_line_text(p, 0, 1, &fake);
+/* -steps n, -time ms, -mem bytes: which of basic_set_limits()'s limits
+   arg sets, or -1 if it is not a limit option */
+static int limit_option(const char* arg) {
+    static const char* const names[] = { "-steps", "-time", "-mem" };
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(arg, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static int parse_limit(const char* option, const char* value, long long* limit) {
+    char* end;
+    long long v = strtoll(value, &end, 10);
+    if (end == value || *end || v < 0) {
+        fprintf(stderr, "Bad value for %s: %s\n", option, value);
+        return 1;
     }
+    *limit = v;
     return 0;
 }
 
-int main(void) {
-    init_vars();
-    printf("Tiny BASIC Interpreter\n");
-    printf("Commands: LOAD, SAVE, RUN, LIST, NEW, QUIT\n");
-    printf("Statements: PRINT, LET, GOTO, IF, END, DIM\n");
-    printf("Variables: A-Z (integers). Type line number + statement to add a line.\n\n");
+static int run_batch(int argc, char** argv) {
+    Batch b;
+    int threads = cpu_count(), status = 0;
+    memset(&b, 0, sizeof(b));
+    for (int i = 0; i < argc; i++) {
+        int k = limit_option(argv[i]);
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (k >= 0 && i + 1 < argc) {
+            if (parse_limit(argv[i], argv[i + 1], &b.limits[k])) return 1;
+            i++;
+        } else if (batch_add_target(&b, argv[i]) != 0) return 1;
+    }
+    if (b.num_jobs == 0) {
+        printf("Usage: basic -batch [-j threads] [-steps n] [-time ms] [-mem bytes] file|directory|@list ...\n");
+        return 1;
+    }
+    run_pool(threads, b.num_programs, batch_load, &b);
+    run_pool(threads, b.num_jobs, batch_run, &b);
+    for (int i = 0; i < b.num_jobs; i++) {
+        BatchJob* job = &b.jobs[i];
+        printf("==> %s <==\n", job->label);
+        fwrite(job->out.data, 1, job->out.len, stdout);
+        if (!b.programs[job->prog].in || job->status > BASIC_OK) status = 1;
+    }
+    batch_free(&b);
+    return status;
+}
+
+/*
+ * Benchmarks: basic -bench [-save file] [-check file] target... runs each
+ * program (targets as for -batch; see bench/) on every execution path: the
+ * text interpreter, the VM with OPTIMIZE OFF and ON, the JIT where
+ * available, and the program translated by COMPILE and built with $CC (cc,
+ * or cl on Windows), timed as a process run with its output to a file. It
+ * prints wall time, statements per second and speedup over the text
+ * interpreter, and fails if any path prints something different.
+ * -save writes the times to a file; -check fails when a path is more than
+ * BENCH_SLOWER percent slower than in such a file.
+ */
+#define BENCH_RUNS      3       /* compiled paths: best of this many runs */
+#define BENCH_SLOWER    20
+
+enum { PATH_TEXT, PATH_BYTECODE, PATH_OPTIMIZED, PATH_JIT, PATH_C, NUM_PATHS };
+static const char* const path_names[NUM_PATHS] = { "text", "bytecode", "optimized", "jit", "c" };
+
+/* Files of the c path, in the current directory */
+#define BENCH_C_SRC     "bench_c.c"
+#define BENCH_C_OUT     "bench_c.out"
+#ifdef _WIN32
+#define BENCH_C_EXE     "bench_c.exe"
+#define BENCH_C_BUILD   "%s /nologo /O2 /Fe" BENCH_C_EXE " " BENCH_C_SRC " >NUL"
+#define BENCH_C_RUN     BENCH_C_EXE " <NUL >" BENCH_C_OUT " 2>NUL"
+#define BENCH_CC        "cl"
+#else
+#define BENCH_C_EXE     "bench_c"
+#define BENCH_C_BUILD   "%s -O3 -o " BENCH_C_EXE " " BENCH_C_SRC
+#define BENCH_C_RUN     "./" BENCH_C_EXE " </dev/null >" BENCH_C_OUT " 2>/dev/null"
+#define BENCH_CC        "cc"
+#endif
+
+/* Translate the compiled program to C and build it; returns 0 on success */
+static int bench_build_c(Interp* in) {
+    const char* cc = getenv("CC");
+    char cmd[1024];
+    FILE* f = fopen(BENCH_C_SRC, "w");
+    if (!f) return -1;
+    compile_c(in, f);
+    fclose(f);
+    snprintf(cmd, sizeof(cmd), BENCH_C_BUILD, cc && *cc ? cc : BENCH_CC);
+    return system(cmd) == 0 ? 0 : -1;
+}
+
+/* Run the program with execute_line_text(), each line detokenized once and
+   re-parsed on every execution. Returns the number of statements run. */
+static long long run_text(Interp* in) {
+    Program* prog = in->prog;
+    int n = prog->num_lines;
+    char** text = (char**)malloc((size_t)n * sizeof(char*));
+    long long steps = 0;
+    for (int i = 0; i < n; i++) {
+        Capture c = { NULL, 0, 0 };
+        detokenize(prog, write_capture, &c, prog->lines[i].tok);
+        write_capture(&c, "", 1);
+        text[i] = c.data;
+    }
+    init_vars(in);
+    for (int i = 0; i >= 0 && i < n; steps++) i = execute_line_text(in, text[i], i, n, prog->lines);
+    out_flush(in);
+    for (int i = 0; i < n; i++) free(text[i]);
+    free(text);
+    return steps;
+}
+
+/* Time of one run on the given path, in ns; the code must be compiled */
+static unsigned long long bench_once(Interp* in, int path, Capture* out, long long* steps) {
+    unsigned long long t = clock_ns();
+    out->len = 0;
+    if (path == PATH_TEXT) {
+        *steps = run_text(in);
+    } else if (path == PATH_C) {
+        size_t size;
+        char* data;
+        (void)system(BENCH_C_RUN);     /* nonzero for a stopped run */
+        t = clock_ns() - t;
+        if ((data = read_file(BENCH_C_OUT, &size)) != NULL) write_capture(out, data, size);
+        free(data);
+        return t;
+    } else {
+        init_vars(in);
+        run_compiled(in, 0);
+    }
+    return clock_ns() - t;
+}
+
+/* Baseline time in ms for "workload path" from a -save file, or -1 */
+static double bench_baseline(const char* saved, const char* workload, const char* path) {
+    size_t wl = strlen(workload), pl = strlen(path);
+    for (const char* p = saved; p && *p; ) {
+        const char* eol = strchr(p, '\n');
+        if (strncmp(p, workload, wl) == 0 && p[wl] == ' ' && strncmp(p + wl + 1, path, pl) == 0 && p[wl + 1 + pl] == ' ')
+            return atof(p + wl + 2 + pl);
+        p = eol ? eol + 1 : NULL;
+    }
+    return -1;
+}
+
+static int run_bench(int argc, char** argv) {
+    Batch b;
+    Capture ref = { NULL, 0, 0 }, out = { NULL, 0, 0 };
+    const char *save_name = NULL, *check_name = NULL;
+    char* saved = NULL;
+    FILE* save = NULL;
+    size_t size;
+    int status = 0;
+    memset(&b, 0, sizeof(b));
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-save") == 0 && i + 1 < argc) save_name = argv[++i];
+        else if (strcmp(argv[i], "-check") == 0 && i + 1 < argc) check_name = argv[++i];
+        else if (batch_add_target(&b, argv[i]) != 0) return 1;
+    }
+    if (b.num_programs == 0) {
+        printf("Usage: basic -bench [-save file] [-check file] file|directory|@list ...\n");
+        return 1;
+    }
+    if (check_name && !(saved = read_file(check_name, &size))) {
+        printf("Cannot open file: %s\n", check_name);
+        return 1;
+    }
+    if (save_name && !(save = fopen(save_name, "w"))) {
+        printf("Cannot create file: %s\n", save_name);
+        free(saved);
+        return 1;
+    }
+    printf("%-24s %12s  %-10s %10s %9s %8s\n", "workload", "statements", "path", "ms", "Mstmt/s", "speedup");
+    for (int w = 0; w < b.num_programs; w++) {
+        const char* name = b.programs[w].path;
+        char* data = read_file(name, &size);
+        Interp* in;
+        long long steps = 0;
+        double text_ms = 0;
+        if (!data) {
+            printf("Cannot open file: %s\n", name);
+            status = 1;
+            continue;
+        }
+        in = basic_create();
+        load_text(in->prog, data, size);
+        free(data);
+        basic_set_output(in, write_capture, &out);
+        basic_set_input(in, NULL, NULL);
+        for (int path = 0; path < NUM_PATHS; path++) {
+            unsigned long long best = 0;
+            double ms, base;
+            const char* note = "";
+            if (path == PATH_JIT && !JIT_SUPPORTED) continue;
+            if (path != PATH_TEXT) {
+                in->optimize = path >= PATH_OPTIMIZED;
+                in->jit_enabled = path == PATH_JIT;
+                compile_program(in);
+            }
+            if (path == PATH_C && bench_build_c(in) != 0) {
+                printf("%-24s %12s  %-10s %10s  BUILD FAILED\n", "", "", path_names[path], "-");
+                status = 1;
+                continue;
+            }
+            for (int r = 0; r < (path == PATH_TEXT ? 1 : BENCH_RUNS); r++) {
+                unsigned long long t = bench_once(in, path, &out, &steps);
+                if (r == 0 || t < best) best = t;
+            }
+            ms = (double)best / 1e6;
+            if (path == PATH_TEXT) {
+                text_ms = ms;
+                ref.len = 0;
+                write_capture(&ref, out.data, out.len);
+            } else if (out.len != ref.len || memcmp(out.data, ref.data, out.len) != 0) {
+                note = "  OUTPUT DIFFERS";
+                status = 1;
+            }
+            base = saved ? bench_baseline(saved, name, path_names[path]) : -1;
+            if (base > 0 && ms > base * (100 + BENCH_SLOWER) / 100) {
+                note = "  SLOWER";
+                status = 1;
+            }
+            if (path == PATH_TEXT) printf("%-24s %12lld", name, steps);
+            else printf("%-24s %12s", "", "");
+            printf("  %-10s %10.2f %9.2f %8.2f%s", path_names[path], ms,
+                   ms > 0 ? (double)steps / ms / 1e3 : 0.0, ms > 0 ? text_ms / ms : 0.0, note);
+            if (base > 0) printf(" (was %.2f)", base);
+            printf("\n");
+            if (save) fprintf(save, "%s %s %.3f\n", name, path_names[path], ms);
+        }
+        basic_destroy(in);
+        remove(BENCH_C_SRC);
+        remove(BENCH_C_EXE);
+        remove(BENCH_C_OUT);
+    }
+    if (save) fclose(save);
+    free(saved);
+    free(ref.data);
+    free(out.data);
+    batch_free(&b);
+    return status;
+}
+
+/*
+ * Server mode: basic -serve [-j threads] [-cache n] [-root dir] [-steps n]
+ * [-time ms] [-mem bytes] address listens on a TCP port (port or
+ * host:port, the host defaulting to 127.0.0.1) or, except on Windows, on a
+ * Unix socket (any other address is its path). Each connection sends one
+ * request as header lines, gets the program's output streamed back, as
+ * batch mode would capture it, and is closed:
+ *
+ *   PROGRAM len     the program follows: len bytes in the format read by LOAD
+ *   INPUT len       INPUT reads the len bytes that follow
+ *   INPUT           INPUT reads the rest of the connection after RUN
+ *   SET A=1 B=-2    presets, as in a batch list
+ *   RUN [file]      run the PROGRAM, or a program file under the -root
+ *                   directory, named by a relative path without ".."
+ *
+ * Without -root a client can only run programs it sends. Without INPUT a
+ * program gets no input. Compiled programs are cached by a hash of their
+ * text, so a repeat submission skips loading and compiling: every run gets
+ * a fresh context sharing the cached program read-only. The cache keeps
+ * the -cache most recently used programs. Worker threads, the main thread
+ * included, each accept and serve connections.
+ */
+#define SERVE_CACHE     64          /* programs, see -cache */
+#define SERVE_LINE      4096        /* longest header line */
+#define SERVE_MAX_BYTES (1 << 30)   /* largest PROGRAM or INPUT */
+
+#ifdef _WIN32
+typedef SOCKET Socket;
+#define close_socket(s)     closesocket(s)
+#else
+typedef int Socket;
+#define INVALID_SOCKET      (-1)
+#define close_socket(s)     close(s)
+#endif
+
+/* Cached program: the text it was loaded from and its compiled context */
+typedef struct {
+    unsigned long long hash;
+    char* text;
+    size_t len;
+    Interp* in;
+    int users;                  /* runs sharing it right now */
+    int cached;                 /* in the cache, else freed by the last user */
+    unsigned long long used;    /* cache tick of the last lookup */
+} ServeProgram;
+
+typedef struct {
+    Socket listener;
+    long long limits[3];        /* for every run, see limit_option() */
+    const char* root;           /* directory RUN file reads from, or NULL */
+    Mutex lock;                 /* guards the cache */
+    ServeProgram** cache;
+    int cache_len, cache_cap;
+    unsigned long long tick;
+} Server;
+
+/* One connection: buffered reads of the request, output writes */
+typedef struct {
+    Socket s;
+    char buf[4096];
+    int pos, len;
+    int broken;                 /* a write failed: the client is gone */
+    Interp* in;                 /* the run writing to it, interrupted if broken */
+    const char* input;          /* INPUT len bytes, or NULL */
+    size_t input_left;
+} Conn;
+
+static int conn_fill(Conn* c) {
+    int n = (int)recv(c->s, c->buf, (int)sizeof(c->buf), 0);
+    c->pos = 0;
+    c->len = n > 0 ? n : 0;
+    return c->len;
+}
 
-    char buf[MAX_LINELEN];
+/* Next header line into line, without its newline; -1 at the end of
+   the connection or if the line is too long */
+static int conn_line(Conn* c, char* line, int cap) {
+    int n = 0;
     for (;;) {
-        printf("> ");
-        fflush(stdout);
-        if (!fgets(buf, sizeof(buf), stdin)) break;
-        if (process_input(buf)) break;
+        char ch;
+        if (c->pos == c->len && !conn_fill(c)) return -1;
+        ch = c->buf[c->pos++];
+        if (ch == '\n') break;
+        if (n == cap - 1) return -1;
+        line[n++] = ch;
     }
-    printf("Goodbye.\n");
+    if (n && line[n - 1] == '\r') n--;
+    line[n] = '\0';
+    return n;
+}
 
-    for (int i = 0; i < NUM_VARS; i++) {
-        if (arrays[i]) free(arrays[i]);
+/* The count bytes that follow, NUL-terminated in a new buffer, or NULL */
+static char* conn_bytes(Conn* c, const char* count, size_t* len) {
+    char* end;
+    unsigned long n = strtoul(count, &end, 10);
+    char* data;
+    size_t got = 0;
+    if (end == count || *end || n > SERVE_MAX_BYTES) return NULL;
+    data = (char*)malloc((size_t)n + 1);
+    while (got < n) {
+        size_t k;
+        if (c->pos == c->len && !conn_fill(c)) { free(data); return NULL; }
+        k = (size_t)(c->len - c->pos) < n - got ? (size_t)(c->len - c->pos) : n - got;
+        memcpy(data + got, c->buf + c->pos, k);
+        c->pos += (int)k;
+        got += k;
+    }
+    data[n] = '\0';
+    *len = (size_t)n;
+    return data;
+}
+
+static void write_conn(void* user, const char* data, size_t len) {
+    Conn* c = (Conn*)user;
+    while (len && !c->broken) {
+        int n = (int)send(c->s, data, (int)(len < 65536 ? len : 65536), 0);
+        if (n <= 0) {
+            c->broken = 1;
+            if (c->in) basic_interrupt(c->in);
+            break;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+/* INPUT len: the bytes sent with the request */
+static size_t read_conn_bytes(void* user, char* buf, size_t len) {
+    Conn* c = (Conn*)user;
+    if (len > c->input_left) len = c->input_left;
+    memcpy(buf, c->input, len);
+    c->input += len;
+    c->input_left -= len;
+    return len;
+}
+
+/* INPUT: the rest of the connection, as it arrives */
+static size_t read_conn_stream(void* user, char* buf, size_t len) {
+    Conn* c = (Conn*)user;
+    if (c->pos == c->len && !conn_fill(c)) return 0;
+    if (len > (size_t)(c->len - c->pos)) len = (size_t)(c->len - c->pos);
+    memcpy(buf, c->buf + c->pos, len);
+    c->pos += (int)len;
+    return len;
+}
+
+static void serve_program_free(ServeProgram* p) {
+    basic_destroy(p->in);
+    free(p->text);
+    free(p);
+}
+
+/* Cached entry for text[0..len), with users counted; caller holds the lock */
+static ServeProgram* cache_find(Server* srv, unsigned long long h, const char* text, size_t len) {
+    for (int i = 0; i < srv->cache_len; i++) {
+        ServeProgram* p = srv->cache[i];
+        if (p->hash == h && p->len == len && memcmp(p->text, text, len) == 0) {
+            p->users++;
+            p->used = ++srv->tick;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* Add p in place of the least recently used idle program if the cache is
+   full; p stays uncached if every program is in use. Caller holds the lock. */
+static void cache_insert(Server* srv, ServeProgram* p) {
+    int victim = -1;
+    p->used = ++srv->tick;
+    if (srv->cache_len < srv->cache_cap) {
+        srv->cache[srv->cache_len++] = p;
+        p->cached = 1;
+        return;
+    }
+    for (int i = 0; i < srv->cache_len; i++) {
+        if (!srv->cache[i]->users && (victim < 0 || srv->cache[i]->used < srv->cache[victim]->used)) victim = i;
+    }
+    if (victim < 0) return;
+    serve_program_free(srv->cache[victim]);
+    srv->cache[victim] = p;
+    p->cached = 1;
+}
+
+/* The compiled program for text[0..len), from the cache or loaded and
+   compiled now; give it back with cache_release() */
+static ServeProgram* cache_acquire(Server* srv, const char* text, size_t len) {
+    unsigned long long h = 14695981039346656037ull;
+    ServeProgram* p;
+    ServeProgram* q;
+    char* work;
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)text[i]) * 1099511628211ull;
+    mutex_lock(&srv->lock);
+    p = cache_find(srv, h, text, len);
+    mutex_unlock(&srv->lock);
+    if (p) return p;
+
+    p = (ServeProgram*)calloc(1, sizeof(ServeProgram));
+    p->hash = h;
+    p->text = copy_string(text, len);
+    p->len = len;
+    p->in = basic_create();
+    work = copy_string(text, len);
+    load_text(p->in->prog, work, len);
+    free(work);
+    if (p->in->prog->num_lines) compile_program(p->in);
+    p->users = 1;
+
+    mutex_lock(&srv->lock);
+    q = cache_find(srv, h, text, len);    /* another worker was quicker */
+    if (!q) cache_insert(srv, p);
+    mutex_unlock(&srv->lock);
+    if (q) {
+        serve_program_free(p);
+        p = q;
+    }
+    return p;
+}
+
+static void cache_release(Server* srv, ServeProgram* p) {
+    int drop;
+    mutex_lock(&srv->lock);
+    drop = --p->users == 0 && !p->cached;
+    mutex_unlock(&srv->lock);
+    if (drop) serve_program_free(p);
+}
+
+/* Run text[0..len) for the connection with the presets and INPUT source
+   of its request */
+static void serve_run(Server* srv, Conn* c, const char* text, size_t len, int mask, const int* preset, BasicReadFn read) {
+    ServeProgram* p = cache_acquire(srv, text, len);
+    Interp* in;
+    int status;
+    if (p->in->prog->num_lines == 0) {
+        write_conn(c, "No program.\n", 12);
+        cache_release(srv, p);
+        return;
+    }
+    in = interp_share(p->in);
+    basic_set_threads(in, 1);     /* so do the other connections */
+    basic_set_output(in, write_conn, c);
+    basic_set_input(in, read, c);
+    basic_set_limits(in, srv->limits[0], srv->limits[1], srv->limits[2]);
+    init_vars(in);
+    for (int v = 0; v < NUM_VARS; v++) {
+        if (mask & (1 << v)) in->vars[v] = preset[v];
+    }
+    c->in = in;
+    status = run_compiled(in, 0);
+    if (status != BASIC_OK) {
+        char msg[64];
+        stop_message(in, status, msg, sizeof(msg));
+        write_conn(c, msg, strlen(msg));
+    }
+    c->in = NULL;
+    basic_destroy(in);
+    cache_release(srv, p);
+}
+
+/* May RUN read name? Only a relative path under -root, without ".." */
+static int serve_path_ok(const Server* srv, const char* name) {
+    if (!srv->root || name[0] == '/' || name[0] == '\\' || strchr(name, ':')) return 0;
+    for (const char* p = name; *p; ) {
+        size_t n = strcspn(p, "/\\");
+        if (n == 2 && p[0] == '.' && p[1] == '.') return 0;
+        p += n;
+        if (*p) p++;
+    }
+    return 1;
+}
+
+/* Read one request from s and answer it */
+static void serve_request(Server* srv, Socket s) {
+    Conn* c = (Conn*)calloc(1, sizeof(Conn));
+    char line[SERVE_LINE];
+    char* text = NULL;
+    char* input = NULL;
+    size_t len = 0;
+    int mask = 0, preset[NUM_VARS];
+    BasicReadFn read = NULL;
+    c->s = s;
+    for (;;) {
+        const char* arg;
+        if (conn_line(c, line, sizeof(line)) < 0) {
+            write_conn(c, "Bad request.\n", 13);
+            break;
+        }
+        arg = strchr(line, ' ') ? strchr(line, ' ') + 1 : "";
+        if (strncmp(line, "PROGRAM ", 8) == 0) {
+            free(text);
+            if (!(text = conn_bytes(c, arg, &len))) { write_conn(c, "Bad request.\n", 13); break; }
+        } else if (strcmp(line, "INPUT") == 0) {
+            read = read_conn_stream;
+        } else if (strncmp(line, "INPUT ", 6) == 0) {
+            free(input);
+            if (!(input = conn_bytes(c, arg, &c->input_left))) { write_conn(c, "Bad request.\n", 13); break; }
+            c->input = input;
+            read = read_conn_bytes;
+        } else if (strncmp(line, "SET ", 4) == 0) {
+            if (parse_presets(arg, &mask, preset) != 0) { write_conn(c, "Bad request.\n", 13); break; }
+        } else if (strcmp(line, "RUN") == 0 || strncmp(line, "RUN ", 4) == 0) {
+            char path[SERVE_LINE * 2];
+            while (*arg == ' ' || *arg == '\t') arg++;
+            if (*arg && !serve_path_ok(srv, arg)) {
+                write_conn(c, "Bad request.\n", 13);
+                break;
+            }
+            if (*arg) {
+                free(text);
+                snprintf(path, sizeof(path), "%s/%s", srv->root, arg);
+                if (!(text = read_file(path, &len))) {
+                    write_conn(c, "Cannot open file: ", 18);
+                    write_conn(c, arg, strlen(arg));
+                    write_conn(c, "\n", 1);
+                    break;
+                }
+            }
+            if (text) serve_run(srv, c, text, len, mask, preset, read);
+            else write_conn(c, "No program.\n", 12);
+            break;
+        } else {
+            write_conn(c, "Bad request.\n", 13);
+            break;
+        }
+    }
+    close_socket(s);
+    free(text);
+    free(input);
+    free(c);
+}
+
+static void serve_work(Server* srv) {
+    for (;;) {
+        Socket s = accept(srv->listener, NULL, NULL);
+        if (s != INVALID_SOCKET) serve_request(srv, s);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI serve_thread(LPVOID arg) { serve_work((Server*)arg); return 0; }
+#else
+static void* serve_thread(void* arg) { serve_work((Server*)arg); return NULL; }
+#endif
+
+/* Listening socket for a -serve address, or INVALID_SOCKET after saying why */
+static Socket serve_listen(const char* addr) {
+    const char* colon = strrchr(addr, ':');
+    Socket s = INVALID_SOCKET;
+    size_t n = strspn(addr, "0123456789");
+    if (colon || (n && !addr[n])) {
+        struct addrinfo hints, *res, *ai;
+        char host[256];
+        const char* port = colon ? colon + 1 : addr;
+        size_t hl = colon ? (size_t)(colon - addr) : 0;
+        int one = 1;
+        if (hl >= sizeof(host)) hl = sizeof(host) - 1;
+        memcpy(host, addr, hl);
+        host[hl] = '\0';
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if (getaddrinfo(hl ? host : "127.0.0.1", port, &hints, &res) != 0) {
+            fprintf(stderr, "Cannot resolve address: %s\n", addr);
+            return INVALID_SOCKET;
+        }
+        for (ai = res; ai && s == INVALID_SOCKET; ai = ai->ai_next) {
+            s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (s == INVALID_SOCKET) continue;
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+            if (bind(s, ai->ai_addr, (int)ai->ai_addrlen) != 0 || listen(s, SOMAXCONN) != 0) {
+                close_socket(s);
+                s = INVALID_SOCKET;
+            }
+        }
+        freeaddrinfo(res);
+    } else {
+#ifdef _WIN32
+        fprintf(stderr, "Unix sockets are not available on this platform: %s\n", addr);
+        return INVALID_SOCKET;
+#else
+        struct sockaddr_un sa;
+        struct stat st;
+        if (strlen(addr) >= sizeof(sa.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", addr);
+            return INVALID_SOCKET;
+        }
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strcpy(sa.sun_path, addr);
+        if (stat(addr, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(addr);   /* left by an earlier server */
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s != INVALID_SOCKET && (bind(s, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(s, SOMAXCONN) != 0)) {
+            close_socket(s);
+            s = INVALID_SOCKET;
+        }
+#endif
+    }
+    if (s == INVALID_SOCKET) fprintf(stderr, "Cannot listen on %s\n", addr);
+    return s;
+}
+
+static int run_serve(int argc, char** argv) {
+    Server srv;
+    Thread* threads;
+    const char* addr = NULL;
+    int num_threads = cpu_count();
+    memset(&srv, 0, sizeof(srv));
+    srv.cache_cap = SERVE_CACHE;
+    for (int i = 0; i < argc; i++) {
+        int k = limit_option(argv[i]);
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) num_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc) srv.cache_cap = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-root") == 0 && i + 1 < argc) srv.root = argv[++i];
+        else if (k >= 0 && i + 1 < argc) {
+            if (parse_limit(argv[i], argv[i + 1], &srv.limits[k])) return 1;
+            i++;
+        } else if (!addr && argv[i][0] != '-') {
+            addr = argv[i];
+        } else {
+            addr = NULL;
+            break;
+        }
+    }
+    if (!addr) {
+        printf("Usage: basic -serve [-j threads] [-cache n] [-root dir] [-steps n] [-time ms] [-mem bytes] port|host:port|socket\n");
+        return 1;
+    }
+#ifdef _WIN32
+    {
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+            fprintf(stderr, "Cannot start Winsock\n");
+            return 1;
+        }
     }
+#else
+    signal(SIGPIPE, SIG_IGN);   /* a client that went away fails the write instead */
+#endif
+    if ((srv.listener = serve_listen(addr)) == INVALID_SOCKET) return 1;
+    if (num_threads < 1) num_threads = 1;
+    if (srv.cache_cap < 0) srv.cache_cap = 0;
+    srv.cache = (ServeProgram**)calloc((size_t)srv.cache_cap + 1, sizeof(ServeProgram*));
+    mutex_init(&srv.lock);
+    printf("Listening on %s\n", addr);
+    fflush(stdout);
+    threads = (Thread*)calloc((size_t)num_threads, sizeof(Thread));
+    for (int i = 1; i < num_threads; i++) thread_start(&threads[i], serve_thread, &srv);
+    serve_work(&srv);
     return 0;
 }
+
+/* Process lines from f until QUIT or end of input; interactive mode
+   shows a prompt before each line */
+static void run_lines(Interp* in, FILE* f, int interactive) {
+    char* buf = NULL;
+    size_t cap = 0;
+    for (;;) {
+        out_flush(in);
+        if (interactive) {
+            printf("> ");
+            fflush(stdout);
+        }
+        if (read_line(f, &buf, &cap) != 0) break;
+        if (process_input(in, buf)) break;
+    }
+    out_flush(in);
+    free(buf);
+}
+
+/* Load and run filename, or resume it from the checkpoint resume, without
+   any REPL output */
+static int run_file(Interp* in, const char* filename, const char* resume) {
+    size_t size;
+    int status;
+    char msg[64];
+    char* data = read_file(filename, &size);
+    if (!data) {
+        fprintf(stderr, "Cannot open file: %s\n", filename);
+        return 1;
+    }
+    load_text(in->prog, data, size);
+    free(data);
+    status = resume ? basic_resume(in, resume) : basic_run(in);
+    if (status == BASIC_NO_PROGRAM && resume) return 1;
+    if (status > BASIC_OK) {
+        stop_message(in, status, msg, sizeof(msg));
+        fputs(msg, stderr);
+        return 1;
+    }
+    return 0;
+}
+
+/* Load filename and translate it to C in out */
+static int compile_file(Interp* in, const char* filename, const char* out) {
+    size_t size;
+    char* data = read_file(filename, &size);
+    if (!data) {
+        fprintf(stderr, "Cannot open file: %s\n", filename);
+        return 1;
+    }
+    load_text(in->prog, data, size);
+    free(data);
+    return do_compile(in, out) != 0;
+}
+
+/* Ctrl-C and SIGTERM stop a running program (saving a -checkpoint); at the
+   prompt they quit as usual. SIGUSR1 saves a checkpoint and goes on. */
+static Interp* volatile sigint_target;
+
+static void on_sigusr1(int sig) {
+    if (sigint_target) basic_request_checkpoint(sigint_target);
+    signal(sig, on_sigusr1);
+}
+
+static void on_sigint(int sig) {
+    if (sigint_target && sigint_target->run_mode) {
+        basic_interrupt(sigint_target);
+        signal(sig, on_sigint);
+    } else {
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+}
+
+/*
+ * basic                 REPL; reads commands quietly when stdin is not a terminal
+ * basic file.bas        run the program and exit
+ * basic -e line ...     process each line as if typed, then exit
+ * basic - | -i          read commands from stdin quietly | with banner and prompts
+ * basic -p ...          profile every RUN (PROFILE ON)
+ * basic -trace f ...    trace every RUN (TRACE ON), saving the trace to f
+ * basic -steps n ...    stop runs after n lines; likewise -time ms, -mem bytes
+ * basic -checkpoint f   save a checkpoint to f when a run stops
+ *       -every n        ... and every n lines
+ * basic -resume f x.bas run x.bas from the checkpoint f
+ * basic -input f ...    INPUT reads f instead of stdin
+ * basic -j n ...        run PARALLEL FOR loops on n threads
+ * basic -compile f x.bas translate x.bas to C in f instead of running it
+ * basic -batch ...      see run_batch()
+ * basic -bench ...      see run_bench()
+ * basic -serve ...      see run_serve()
+ * Options are processed in order, so -e "OPTIMIZE OFF" file.bas works.
+ */
+int main(int argc, char** argv) {
+    Interp* in;
+    int status = 0, done = 0, interactive, k;
+    long long limits[3] = { 0, 0, 0 }, every = 0;
+    const char* checkpoint = NULL;
+    const char* resume = NULL;
+    const char* compile_to = NULL;
+    FILE* input = NULL;
+    if (argc > 1 && strcmp(argv[1], "-batch") == 0) return run_batch(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "-bench") == 0) return run_bench(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "-serve") == 0) return run_serve(argc - 2, argv + 2);
+    in = basic_create();
+    in->out_unbuffered = isatty(fileno(stdout));
+    interactive = isatty(fileno(stdin));
+    sigint_target = in;
+    signal(SIGINT, on_sigint);
+    signal(SIGTERM, on_sigint);
+#ifdef SIGUSR1
+    signal(SIGUSR1, on_sigusr1);
+#endif
+    for (int i = 1; i < argc && !status; i++) {
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            if (basic_exec(in, argv[++i])) break;
+            out_flush(in);
+            done = 1;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            in->profile = 1;
+        } else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+            in->trace = 1;
+            in->trace_vars = (1u << NUM_VARS) - 1;
+            in->trace_file = argv[++i];
+        } else if (strcmp(argv[i], "-checkpoint") == 0 && i + 1 < argc) {
+            checkpoint = argv[++i];
+            basic_set_checkpoint(in, checkpoint, every);
+        } else if (strcmp(argv[i], "-every") == 0 && i + 1 < argc) {
+            if (parse_limit(argv[i], argv[i + 1], &every)) status = 2;
+            basic_set_checkpoint(in, checkpoint, every);
+            i++;
+        } else if (strcmp(argv[i], "-resume") == 0 && i + 1 < argc) {
+            resume = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            basic_set_threads(in, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-compile") == 0 && i + 1 < argc) {
+            compile_to = argv[++i];
+        } else if (strcmp(argv[i], "-input") == 0 && i + 1 < argc) {
+            if (input) fclose(input);
+            if (!(input = fopen(argv[++i], "rb"))) {
+                fprintf(stderr, "Cannot open file: %s\n", argv[i]);
+                status = 1;
+            }
+            basic_set_input(in, read_stream, input);
+        } else if ((k = limit_option(argv[i])) >= 0 && i + 1 < argc) {
+            if (parse_limit(argv[i], argv[i + 1], &limits[k])) status = 2;
+            basic_set_limits(in, limits[0], limits[1], limits[2]);
+            i++;
+        } else if (strcmp(argv[i], "-i") == 0) {
+            interactive = 1;
+        } else if (strcmp(argv[i], "-") == 0) {
+            interactive = 0;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: basic [-p] [-trace file] [-steps n] [-time ms] [-mem bytes] [-checkpoint file [-every n]] [-input file] [-j threads] [-e line]... [-i | - | [-resume file | -compile file.c] file.bas]  or  basic -batch|-bench|-serve ...\n");
+            status = 2;
+        } else {
+            status = compile_to ? compile_file(in, argv[i], compile_to) : run_file(in, argv[i], resume);
+            done = 1;
+        }
+    }
+    if (!done && !status) {
+        if (interactive) {
+            printf("Tiny BASIC Interpreter\n");
+            printf("Commands: LOAD, SAVE, CLOAD, CSAVE, COMPILE, RUN, LIST, NEW, RESUME, CHECKPOINT, OPTIMIZE, JIT, PROFILE, TRACE, BUFFER, QUIT\n");
+            printf("Statements: PRINT, LET, GOTO, IF, END, DIM, FOR, NEXT, PARALLEL FOR, GOSUB, RETURN, MAT, INPUT, DATA, READ, RESTORE\n");
+            printf("Variables: A-Z (integers). Type line number + statement to add a line.\n\n");
+        }
+        if (!input) basic_set_input(in, read_stream_line, stdin);
+        run_lines(in, stdin, interactive);
+        if (interactive) printf("Goodbye.\n");
+    }
+    sigint_target = NULL;
+    basic_destroy(in);
+    if (input) fclose(input);
+    return status;
+}
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Tiny BASIC embedding API
+ * Build basic.c with BASIC_NO_MAIN defined and link it into the host.
+ * Each interpreter owns its program, variables and output buffer, so
+ * separate interpreters may run on separate threads.
+ */
+
+#ifndef BASIC_H
+#define BASIC_H
+
+#include <stddef.h>
+
+typedef struct Interp Interp;
+
+/* Receives PRINT output in chunks */
+typedef void (*BasicWriteFn)(void* user, const char* data, size_t len);
+
+/* New interpreter with an empty program, printing to stdout */
+Interp* basic_create(void);
+void basic_destroy(Interp* in);
+
+/* New interpreter that runs src's program, compiled once and shared
+   read-only, with its own variables and output. src must not change or
+   destroy its program while such interpreters exist. */
+Interp* basic_share(Interp* src);
+
+/* Send output to fn(user, ...) instead of stdout */
+void basic_set_output(Interp* in, BasicWriteFn fn, void* user);
+
+/* Supplies INPUT data: fills buf with up to len bytes and returns how
+   many, 0 at end of input */
+typedef size_t (*BasicReadFn)(void* user, char* buf, size_t len);
+
+/* Take INPUT from fn(user, ...) instead of stdin; NULL for no input */
+void basic_set_input(Interp* in, BasicReadFn fn, void* user);
+
+/* Replace the program with the numbered lines in text[0..len), in the
+   format read by LOAD */
+void basic_load(Interp* in, const char* text, size_t len);
+
+/* basic_run() results */
+enum {
+    BASIC_NO_PROGRAM = -1,
+    BASIC_OK = 0,           /* reached END or the last line */
+    BASIC_STEP_LIMIT,       /* executed max_steps lines */
+    BASIC_TIME_LIMIT,       /* ran for max_ms milliseconds */
+    BASIC_MEMORY_LIMIT,     /* a DIM would exceed max_array_bytes
+                               or could not be allocated */
+    BASIC_INTERRUPTED,      /* basic_interrupt() was called */
+    BASIC_STACK_OVERFLOW,   /* FOR loops and GOSUBs nested too deeply */
+    BASIC_OUT_OF_DATA       /* READ past the last DATA value, or INPUT
+                               at the end of input */
+};
+
+/* Run the program from cleared variables and flush its output.
+   Returns one of the results above. */
+int basic_run(Interp* in);
+
+/* Limits for later runs, 0 for none. Steps are program lines executed;
+   they are checked on backward jumps, so a run may overshoot a limit by
+   one loop iteration, and time is checked every 65536 lines. */
+void basic_set_limits(Interp* in, long long max_steps, long long max_ms, long long max_array_bytes);
+
+/* Threads a PARALLEL FOR may run on; 0 (the default) for one per
+   processor. Its results are the same for any number. */
+void basic_set_threads(Interp* in, int threads);
+
+/* Stop the run in progress with BASIC_INTERRUPTED. Safe to call from a
+   signal handler or another thread; has no effect on later runs. */
+void basic_interrupt(Interp* in);
+
+/* Save the run's state to filename whenever a run is stopped, and every
+   `every` steps (0 = only when stopped); NULL for none. The name is not
+   copied. */
+void basic_set_checkpoint(Interp* in, const char* filename, long long every);
+
+/* Ask the run in progress to save a checkpoint and go on, within 65536
+   steps. Safe to call from a signal handler or another thread. */
+void basic_request_checkpoint(Interp* in);
+
+/* Restore a checkpoint of the loaded program, which must be unchanged and
+   compiled with the same settings, and continue the run. Returns like
+   basic_run(), or BASIC_NO_PROGRAM if the checkpoint cannot be used. */
+int basic_resume(Interp* in, const char* filename);
+
+/* Process one line as typed at the prompt: a program line, a command or a
+   direct statement. Returns 1 for QUIT, otherwise 0. */
+int basic_exec(Interp* in, const char* line);
+
+/* Variable A-Z by index 0-25 */
+int basic_get_var(Interp* in, int var);
+void basic_set_var(Interp* in, int var, int value);
+
+#endif
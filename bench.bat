@@ -0,0 +1,6 @@
+@echo off
+REM Build, then run the workloads in bench\ on every execution path
+
+call build.bat
+if %ERRORLEVEL% neq 0 exit /b %ERRORLEVEL%
+basic.exe -bench bench
@@ -0,0 +1,7 @@
+10 LET I = 1
+20 LET S = 0
+30 LET S = S + 3
+40 LET I = I + 1
+50 IF I <= 2000000 THEN 30
+60 PRINT "I = ", I, " S = ", S
+70 END
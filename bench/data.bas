@@ -0,0 +1,19 @@
+10 DIM A(64)
+20 FOR N = 1 TO 20000
+30 RESTORE
+40 FOR I = 0 TO 31
+50 READ A(I), X
+60 LET S = S + A(I) * X
+70 NEXT I
+80 RESTORE 330
+90 READ Y
+100 LET T = T + Y
+110 NEXT N
+120 PRINT "S = ", S, " T = ", T
+130 END
+200 DATA 3, 1, 4, 1, 5, 9, 2, 6, 5, 3, 5, 8, 9, 7, 9, 3
+210 DATA 2, 3, 8, 4, 6, 2, 6, 4, 3, 3, 8, 3, 2, 7, 9, 5
+220 DATA 0, 2, 8, 8, 4, 1, 9, 7, 1, 6, 9, 3, 9, 9, 3, 7
+230 DATA 5, 1, 0, 5, 8, 2, 0, 9, 7, 4, 9, 4, 4, 5, 9, 2
+300 DATA -1, -2, -3, -4, -5, -6, -7, -8
+330 DATA 11, 12
@@ -0,0 +1,10 @@
+10 LET I = 0
+20 LET S = 0
+30 LET J = I - I / 100 * 100
+40 LET A = ((J + 1) * (J + 2) - (J + 3) * 2) / ((J - J) + 7)
+50 LET B = (((A * 3 + J) - (A - J) * 2) + ((J / 3) * (A / 5 + 1))) - (((J + A) * 2 - 3) / 4)
+60 LET S = S + A - B + (((((J + 1) + 2) + 3) + 4) + 5) * 2 - ((2 * 3 + 4) * (5 - 1) / 8)
+70 LET I = I + 1
+80 IF I < 800000 THEN 30
+90 PRINT S
+100 END
@@ -0,0 +1,13 @@
+10 DIM A(100)
+20 FOR K = 0 TO 99
+30 LET A(K) = K * 3
+40 NEXT K
+50 LET N = 1000
+60 FOR I = 1 TO N
+70 LET K = I - I / 100 * 100
+80 FOR J = 1 TO N
+90 LET S = S + A(K) * (N - K) + J / (N / 10 + 1)
+100 NEXT J
+110 NEXT I
+120 PRINT "S = ", S
+130 END
@@ -0,0 +1,10 @@
+10 FOR I = 1 TO 1000
+20 FOR J = 1 TO 1000
+30 LET S = S + J / I
+40 NEXT J
+50 GOSUB 100
+60 NEXT I
+70 PRINT "S = ", S, " T = ", T
+80 END
+100 LET T = T + S / 1000
+110 RETURN
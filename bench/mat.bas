@@ -0,0 +1,16 @@
+10 DIM A(1000000)
+20 DIM B(1000000)
+30 DIM C(1000000)
+40 FOR I = 0 TO 999999
+50 LET A(I) = I
+60 NEXT I
+70 MAT FILL B = 3
+80 FOR N = 1 TO 200
+90 MAT C = A * B
+100 MAT C = C + A
+110 MAT B = C - (N)
+120 MAT SUM S = B
+130 LET T = T + S / 1000
+140 NEXT N
+150 PRINT "S = ", S, " T = ", T
+160 END
@@ -0,0 +1,25 @@
+10 LET N = 30000
+20 DIM L(30001)
+30 PARALLEL FOR I = 1 TO N
+40 LET X = I
+50 LET C = 0
+60 IF X = 1 THEN 130
+70 LET Y = X / 2
+80 LET C = C + 1
+90 IF X = Y * 2 THEN 110
+100 LET Y = 3 * X + 1
+110 LET X = Y
+120 GOTO 60
+130 LET L(I) = C
+140 LET S = S + C
+150 NEXT I
+160 PRINT S, L(27), L(N)
+170 LET T = 0
+180 LET K = 0
+190 PARALLEL FOR I = 1 TO N
+200 LET T = T + L(I)
+210 LET L(I) = T
+220 IF T > 100000 THEN 240
+230 LET K = K + 1
+240 NEXT I
+250 PRINT T, L(N / 2), K
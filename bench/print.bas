@@ -0,0 +1,5 @@
+10 LET I = 0
+20 PRINT "line ", I, " value ", I * 7, " text"
+30 LET I = I + 1
+40 IF I < 500000 THEN 20
+50 END
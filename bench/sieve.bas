@@ -0,0 +1,22 @@
+10 LET N = 65000
+20 LET R = 0
+30 DIM P(65001)
+40 LET I = 2
+50 IF I * I > N THEN 130
+60 IF P(I) = 1 THEN 110
+70 LET J = I * I
+80 LET P(J) = 1
+90 LET J = J + I
+100 IF J <= N THEN 80
+110 LET I = I + 1
+120 GOTO 50
+130 LET C = 0
+140 LET I = 2
+150 IF P(I) = 1 THEN 170
+160 LET C = C + 1
+170 LET I = I + 1
+180 IF I <= N THEN 150
+190 LET R = R + 1
+200 IF R < 12 THEN 30
+210 PRINT "primes below ", N, ": ", C
+220 END
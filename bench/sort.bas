@@ -0,0 +1,28 @@
+10 LET N = 1600
+20 DIM A(1600)
+30 LET X = 1
+40 LET I = 0
+50 LET X = X * 75 + 74
+60 LET X = X - X / 65537 * 65537
+70 LET A(I) = X
+80 LET I = I + 1
+90 IF I < N THEN 50
+100 LET I = 1
+110 LET V = A(I)
+120 LET J = I - 1
+130 IF J < 0 THEN 180
+140 IF A(J) <= V THEN 180
+150 LET A(J + 1) = A(J)
+160 LET J = J - 1
+170 GOTO 130
+180 LET A(J + 1) = V
+190 LET I = I + 1
+200 IF I < N THEN 110
+210 LET E = 0
+220 LET I = 1
+230 IF A(I - 1) <= A(I) THEN 250
+240 LET E = E + 1
+250 LET I = I + 1
+260 IF I < N THEN 230
+270 PRINT "sorted ", N, " out of order ", E, " min ", A(0), " max ", A(N - 1)
+280 END